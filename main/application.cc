@@ -4,6 +4,7 @@
 #include "system_info.h"
 #include "ml307_ssl_transport.h"
 #include "audio_codec.h"
+#include "audio_channel_kernels.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
 #include "font_awesome_symbols.h"
@@ -405,10 +406,21 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
+#if CONFIG_USE_SPECULATIVE_AUDIO_CHANNEL
+            if (speculative_connecting_) {
+                // Only one task may open the channel at a time
+                preconnect_waiters_.emplace_back([this](bool opened) {
+                    ToggleChatState();
+                });
                 return;
             }
+#endif
+            if (!protocol_->IsAudioChannelOpened()) {
+                SetDeviceState(kDeviceStateConnecting);
+                if (!protocol_->OpenAudioChannel()) {
+                    return;
+                }
+            }
 
             SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
         });
@@ -436,6 +448,14 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
+#if CONFIG_USE_SPECULATIVE_AUDIO_CHANNEL
+            if (speculative_connecting_) {
+                preconnect_waiters_.emplace_back([this](bool opened) {
+                    StartListening();
+                });
+                return;
+            }
+#endif
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
                 if (!protocol_->OpenAudioChannel()) {
@@ -547,6 +567,13 @@ void Application::Start() {
     }
 
     protocol_->OnNetworkError([this](const std::string& message) {
+        if (speculative_task_handle_ != nullptr && xTaskGetCurrentTaskHandle() == speculative_task_handle_) {
+            // Raised by the speculative open itself. Nobody asked for this channel yet, a wake word
+            // waiting for it gets the error in OnPreconnectDone()
+            ESP_LOGW(TAG, "Speculative audio channel failed: %s", message.c_str());
+            speculative_error_ = message;
+            return;
+        }
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
@@ -580,19 +607,19 @@ void Application::Start() {
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
+    protocol_->OnIncomingJson([this, display](const JsonReader& message) {
+        // Fields are read straight from the text, only MCP and IoT payloads become cJSON trees
+        auto type = message.GetStringView("type");
+        if (type == "tts") {
+            auto state = message.GetStringView("state");
+            if (state == "start") {
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
+            } else if (state == "stop") {
                 Schedule([this]() {
                     background_task_->WaitForCompletion();
                     if (device_state_ == kDeviceStateSpeaking) {
@@ -603,40 +630,41 @@ void Application::Start() {
                         }
                     }
                 });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
+            } else if (state == "sentence_start") {
+                std::string text;
+                if (message.GetString("text", text)) {
+                    ESP_LOGI(TAG, "<< %s", text.c_str());
+                    Schedule([this, display, text = std::move(text)]() {
+                        display->SetChatMessage("assistant", text.c_str());
                     });
                 }
             }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
+        } else if (type == "stt") {
+            std::string text;
+            if (message.GetString("text", text)) {
+                ESP_LOGI(TAG, ">> %s", text.c_str());
+                Schedule([this, display, text = std::move(text)]() {
+                    display->SetChatMessage("user", text.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
+        } else if (type == "llm") {
+            std::string emotion;
+            if (message.GetString("emotion", emotion)) {
+                Schedule([this, display, emotion = std::move(emotion)]() {
+                    display->SetEmotion(emotion.c_str());
                 });
             }
 #if CONFIG_IOT_PROTOCOL_MCP
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
+        } else if (type == "mcp") {
+            auto payload = message.Parse("payload");
             if (cJSON_IsObject(payload)) {
                 McpServer::GetInstance().ParseMessage(payload);
             }
+            cJSON_Delete(payload);
 #endif
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
+        } else if (type == "iot") {
+            auto commands = message.Parse("commands");
             if (cJSON_IsArray(commands)) {
                 auto& thing_manager = iot::ThingManager::GetInstance();
                 for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
@@ -644,31 +672,30 @@ void Application::Start() {
                     thing_manager.Invoke(command);
                 }
             }
+            cJSON_Delete(commands);
 #endif
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
+        } else if (type == "system") {
+            std::string command;
+            if (message.GetString("command", command)) {
+                ESP_LOGI(TAG, "System command: %s", command.c_str());
+                if (command == "reboot") {
                     // Do a reboot if user requests a OTA update
                     Schedule([this]() {
                         Reboot();
                     });
                 } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    ESP_LOGW(TAG, "Unknown system command: %s", command.c_str());
                 }
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
+        } else if (type == "alert") {
+            std::string status, text, emotion;
+            if (message.GetString("status", status) && message.GetString("message", text) && message.GetString("emotion", emotion)) {
+                Alert(status.c_str(), text.c_str(), emotion.c_str(), Lang::Sounds::P3_VIBRATION);
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
         } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            ESP_LOGW(TAG, "Unknown message type: %.*s", (int)type.size(), type.data());
         }
     });
     bool protocol_started = protocol_->Start();
@@ -712,6 +739,10 @@ void Application::Start() {
                     voice_detected_ = true;
                 } else {
                     voice_detected_ = false;
+                    // Do not leave the tail of the utterance waiting for a full batch
+                    if (protocol_) {
+                        protocol_->FlushAudio();
+                    }
                 }
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
@@ -720,40 +751,39 @@ void Application::Start() {
     });
 
     wake_word_->Initialize(codec);
+#if CONFIG_USE_SPECULATIVE_AUDIO_CHANNEL
+    wake_word_->OnVoiceOnset([this]() {
+        Schedule([this]() {
+            PreconnectAudioChannel();
+        });
+    });
+#endif
     wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
-        Schedule([this, &wake_word]() {
+        Schedule([this, wake_word]() {
             if (!protocol_) {
                 return;
             }
 
             if (device_state_ == kDeviceStateIdle) {
                 wake_word_->EncodeWakeWordData();
-
-                if (!protocol_->IsAudioChannelOpened()) {
-                    SetDeviceState(kDeviceStateConnecting);
-                    if (!protocol_->OpenAudioChannel()) {
-                        wake_word_->StartDetection();
-                        return;
-                    }
-                }
-
-                ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
-#if CONFIG_USE_AFE_WAKE_WORD
-                AudioStreamPacket packet;
-                // Encode and send the wake word data to the server
-                while (wake_word_->GetWakeWordOpus(packet.payload)) {
-                    protocol_->SendAudio(packet);
+#if CONFIG_USE_SPECULATIVE_AUDIO_CHANNEL
+                if (speculative_connecting_) {
+                    // The channel is already on its way, wait for that open instead of starting a second one
+                    preconnect_waiters_.emplace_back([this, wake_word](bool opened) {
+                        if (!opened) {
+                            // Report the failure now rather than paying for a second timeout
+                            if (!speculative_error_.empty()) {
+                                Alert(Lang::Strings::ERROR, speculative_error_.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
+                            }
+                            wake_word_->StartDetection();
+                            return;
+                        }
+                        StartWakeWordSession(wake_word);
+                    });
+                    return;
                 }
-                // Set the chat state to wake word detected
-                protocol_->SendWakeWordDetected(wake_word);
-#else
-                // Play the pop up sound to indicate the wake word is detected
-                // And wait 60ms to make sure the queue has been processed by audio task
-                ResetDecoder();
-                PlaySound(Lang::Sounds::P3_POPUP);
-                vTaskDelay(pdMS_TO_TICKS(60));
 #endif
-                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+                StartWakeWordSession(wake_word);
             } else if (device_state_ == kDeviceStateSpeaking) {
                 AbortSpeaking(kAbortReasonWakeWordDetected);
             } else if (device_state_ == kDeviceStateActivating) {
@@ -789,11 +819,29 @@ void Application::OnClockTimer() {
     auto display = Board::GetInstance().GetDisplay();
     display->UpdateStatusBar();
 
+#if CONFIG_USE_SPECULATIVE_AUDIO_CHANNEL
+    // Close a channel opened ahead of a wake word that never came
+    if (speculative_channel_ && device_state_ == kDeviceStateIdle &&
+        esp_timer_get_time() - speculative_channel_time_us_ >= CONFIG_SPECULATIVE_AUDIO_CHANNEL_IDLE_SECONDS * 1000000LL) {
+        Schedule([this]() {
+            if (speculative_channel_ && device_state_ == kDeviceStateIdle && protocol_) {
+                ESP_LOGI(TAG, "Closing unused speculative audio channel");
+                speculative_channel_ = false;
+                protocol_->CloseAudioChannel();
+            }
+        });
+    }
+#endif
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
         SystemInfo::PrintHeapStats();
+        if (main_tasks_.overflow_count() > 0 || main_tasks_.heap_count() > 0) {
+            ESP_LOGW(TAG, "Main tasks: %lu overflowed the queue, %lu captures on the heap",
+                main_tasks_.overflow_count(), main_tasks_.heap_count());
+        }
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
@@ -810,15 +858,6 @@ void Application::OnClockTimer() {
     }
 }
 
-// Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
-    }
-    xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
-}
-
 // The Main Event Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
@@ -838,11 +877,15 @@ void Application::MainEventLoop() {
         }
 
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
+            // Run about one queue's worth, then let pending audio go out before the rest
+            InlineTask task;
+            int budget = TASK_QUEUE_HIGH_CAPACITY + TASK_QUEUE_NORMAL_CAPACITY;
+            while (budget-- > 0 && main_tasks_.Pop(task)) {
                 task();
+                task.Reset();
+            }
+            if (budget < 0) {
+                xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
             }
         }
     }
@@ -952,25 +995,16 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
             return false;
         }
         if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            size_t frames = data.size() / 2;
+            input_resample_scratch_.resize(ResampleInterleavedStereoScratchSize(input_resampler_, frames));
+            frames = ResampleInterleavedStereo(input_resampler_, reference_resampler_,
+                data.data(), frames, input_resample_scratch_.data());
+            data.resize(frames * 2);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
+            auto& resampled = input_resample_scratch_;
+            resampled.resize(input_resampler_.GetOutputSamples(data.size()));
             input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            data.assign(resampled.begin(), resampled.end());
         }
     } else {
         data.resize(samples);
@@ -998,6 +1032,10 @@ void Application::SetDeviceState(DeviceState state) {
     }
     
     clock_ticks_ = 0;
+    if (state != kDeviceStateIdle) {
+        // A conversation owns the channel now
+        speculative_channel_ = false;
+    }
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
@@ -1105,6 +1143,83 @@ void Application::Reboot() {
     esp_restart();
 }
 
+// Called on the main loop with the wake word pre-roll already being encoded
+void Application::StartWakeWordSession(const std::string& wake_word) {
+    if (device_state_ != kDeviceStateIdle) {
+        return;
+    }
+    if (!protocol_->IsAudioChannelOpened()) {
+        SetDeviceState(kDeviceStateConnecting);
+        if (!protocol_->OpenAudioChannel()) {
+            wake_word_->StartDetection();
+            return;
+        }
+    }
+
+    ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+#if CONFIG_USE_AFE_WAKE_WORD
+    AudioStreamPacket packet;
+    // Encode and send the wake word data to the server
+    while (wake_word_->GetWakeWordOpus(packet.payload)) {
+        protocol_->SendAudio(packet);
+    }
+    // Set the chat state to wake word detected
+    protocol_->SendWakeWordDetected(wake_word);
+#else
+    // Play the pop up sound to indicate the wake word is detected
+    // And wait 60ms to make sure the queue has been processed by audio task
+    ResetDecoder();
+    PlaySound(Lang::Sounds::P3_POPUP);
+    vTaskDelay(pdMS_TO_TICKS(60));
+#endif
+    SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+}
+
+// Opens the audio channel as soon as someone starts speaking, so that DNS, TLS and the hello
+// round trip overlap with the wake word itself. The open runs on its own task, since it can
+// wait several seconds for the hello and the main loop must keep running meanwhile. A wake
+// word arriving before it finished waits in preconnect_waiters_ instead of opening again
+void Application::PreconnectAudioChannel() {
+    if (device_state_ != kDeviceStateIdle || !protocol_ || protocol_->IsAudioChannelOpened()) {
+        return;
+    }
+    // Background speech must not reconnect over and over
+    int64_t now = esp_timer_get_time();
+    if (speculative_channel_time_us_ != 0 &&
+        now - speculative_channel_time_us_ < CONFIG_SPECULATIVE_AUDIO_CHANNEL_IDLE_SECONDS * 1000000LL) {
+        return;
+    }
+    speculative_channel_time_us_ = now;
+
+    ESP_LOGI(TAG, "Voice onset, opening the audio channel ahead of the wake word");
+    speculative_connecting_ = true;
+    speculative_error_.clear();
+    auto ret = xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->speculative_task_handle_ = xTaskGetCurrentTaskHandle();
+        bool opened = app->protocol_->OpenAudioChannel();
+        app->speculative_task_handle_ = nullptr;
+        app->Schedule([app, opened]() {
+            app->OnPreconnectDone(opened);
+        });
+        vTaskDelete(NULL);
+    }, "preconnect", 4096 * 2, this, 3, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the preconnect task");
+        speculative_connecting_ = false;
+    }
+}
+
+void Application::OnPreconnectDone(bool opened) {
+    speculative_connecting_ = false;
+    speculative_channel_ = opened && device_state_ == kDeviceStateIdle;
+    auto waiters = std::move(preconnect_waiters_);
+    preconnect_waiters_.clear();
+    for (auto& waiter : waiters) {
+        waiter(opened);
+    }
+}
+
 void Application::WakeWordInvoke(const std::string& wake_word) {
     if (device_state_ == kDeviceStateIdle) {
         ToggleChatState();
@@ -1139,8 +1254,8 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
-    Schedule([this, payload]() {
+void Application::SendMcpMessage(std::string payload) {
+    Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
             protocol_->SendMcpMessage(payload);
         }
@@ -12,6 +12,8 @@
 #include <vector>
 #include <condition_variable>
 #include <memory>
+#include <atomic>
+#include <functional>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
@@ -21,6 +23,7 @@
 #include "protocol.h"
 #include "ota.h"
 #include "background_task.h"
+#include "task_queue.h"
 #include "audio_processor.h"
 #include "wake_word.h"
 
@@ -63,7 +66,14 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    // Runs callback on the main loop. Tasks that depend on each other's order, like device state
+    // transitions, must share one priority. kTaskPriorityHigh is only for order-independent work
+    // that must not wait behind UI updates, like flushing batched audio
+    template <typename F>
+    void Schedule(F&& callback, TaskPriority priority = kTaskPriorityNormal) {
+        main_tasks_.Push(std::forward<F>(callback), priority);
+        xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+    }
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -76,7 +86,7 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     void PlaySound(const std::string_view& sound);
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     BackgroundTask* GetBackgroundTask() const { return background_task_; }
@@ -89,7 +99,7 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     Ota ota_;
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    TaskQueue main_tasks_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
@@ -101,6 +111,16 @@ private:
     bool voice_detected_ = false;
     bool busy_decoding_audio_ = false;
     int clock_ticks_ = 0;
+    // Audio channel opened on voice onset, ahead of the wake word. The flags are also read by
+    // the clock timer and the network tasks
+    std::atomic<bool> speculative_channel_ = false;
+    std::atomic<bool> speculative_connecting_ = false;
+    int64_t speculative_channel_time_us_ = 0;
+    // The task running the speculative open, only its own network errors are held back
+    std::atomic<TaskHandle_t> speculative_task_handle_ = nullptr;
+    std::string speculative_error_;
+    // Main loop work waiting for the speculative open to finish
+    std::vector<std::function<void(bool opened)>> preconnect_waiters_;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     // Audio encode / decode
@@ -121,6 +141,7 @@ private:
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
+    std::vector<int16_t> input_resample_scratch_;
 
     void MainEventLoop();
     void OnAudioInput();
@@ -134,6 +155,9 @@ private:
      void OnClockTimer();
          void SetListeningMode(ListeningMode mode);
     void AudioLoop();
+    void PreconnectAudioChannel();
+    void OnPreconnectDone(bool opened);
+    void StartWakeWordSession(const std::string& wake_word);
     void RefreshToNormalInterface();
  
      
@@ -0,0 +1,87 @@
+#include "audio_channel_kernels.h"
+
+// Word access to int16_t buffers, without breaking strict aliasing
+typedef uint32_t __attribute__((__may_alias__)) pcm_word_t;
+
+static inline bool IsWordAligned(const void* pointer) {
+    return (reinterpret_cast<uintptr_t>(pointer) & 3) == 0;
+}
+
+void DeinterleaveStereo(const int16_t* input, int16_t* first, int16_t* second, size_t frames) {
+    size_t i = 0;
+    if (IsWordAligned(input) && IsWordAligned(first) && IsWordAligned(second)) {
+        auto input_words = reinterpret_cast<const pcm_word_t*>(input);
+        auto first_words = reinterpret_cast<pcm_word_t*>(first);
+        auto second_words = reinterpret_cast<pcm_word_t*>(second);
+        for (; i + 2 <= frames; i += 2) {
+            uint32_t a = input_words[i];      // first[i] | second[i] << 16
+            uint32_t b = input_words[i + 1];  // first[i + 1] | second[i + 1] << 16
+            first_words[i / 2] = (a & 0xFFFF) | (b << 16);
+            second_words[i / 2] = (a >> 16) | (b & 0xFFFF0000);
+        }
+    }
+    for (; i < frames; i++) {
+        first[i] = input[i * 2];
+        second[i] = input[i * 2 + 1];
+    }
+}
+
+void InterleaveStereo(const int16_t* first, const int16_t* second, int16_t* output, size_t frames) {
+    size_t i = 0;
+    if (IsWordAligned(output) && IsWordAligned(first) && IsWordAligned(second)) {
+        auto first_words = reinterpret_cast<const pcm_word_t*>(first);
+        auto second_words = reinterpret_cast<const pcm_word_t*>(second);
+        auto output_words = reinterpret_cast<pcm_word_t*>(output);
+        for (; i + 2 <= frames; i += 2) {
+            uint32_t a = first_words[i / 2];
+            uint32_t b = second_words[i / 2];
+            output_words[i] = (a & 0xFFFF) | (b << 16);
+            output_words[i + 1] = (a >> 16) | (b & 0xFFFF0000);
+        }
+    }
+    for (; i < frames; i++) {
+        output[i * 2] = first[i];
+        output[i * 2 + 1] = second[i];
+    }
+}
+
+void ExtractFirstChannel(int16_t* data, size_t frames) {
+    size_t i = 0;
+    if (IsWordAligned(data)) {
+        // The write position never passes the read position, so this is safe in place
+        auto words = reinterpret_cast<pcm_word_t*>(data);
+        for (; i + 2 <= frames; i += 2) {
+            uint32_t a = words[i];
+            uint32_t b = words[i + 1];
+            words[i / 2] = (a & 0xFFFF) | (b << 16);
+        }
+    }
+    for (; i < frames; i++) {
+        data[i] = data[i * 2];
+    }
+}
+
+// Keep each planar region word aligned, so the paired path above can be used
+static inline size_t AlignFrames(size_t frames) {
+    return (frames + 1) & ~size_t(1);
+}
+
+size_t ResampleInterleavedStereoScratchSize(OpusResampler& resampler, size_t frames) {
+    size_t output_frames = resampler.GetOutputSamples(frames);
+    return AlignFrames(frames) * 2 + AlignFrames(output_frames) * 2;
+}
+
+size_t ResampleInterleavedStereo(OpusResampler& first_resampler, OpusResampler& second_resampler,
+    int16_t* data, size_t frames, int16_t* scratch) {
+    size_t output_frames = first_resampler.GetOutputSamples(frames);
+    int16_t* first_input = scratch;
+    int16_t* second_input = first_input + AlignFrames(frames);
+    int16_t* first_output = second_input + AlignFrames(frames);
+    int16_t* second_output = first_output + AlignFrames(output_frames);
+
+    DeinterleaveStereo(data, first_input, second_input, frames);
+    first_resampler.Process(first_input, frames, first_output);
+    second_resampler.Process(second_input, frames, second_output);
+    InterleaveStereo(first_output, second_output, data, output_frames);
+    return output_frames;
+}
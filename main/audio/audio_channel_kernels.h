@@ -0,0 +1,38 @@
+#ifndef AUDIO_CHANNEL_KERNELS_H
+#define AUDIO_CHANNEL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <opus_resampler.h>
+
+/*
+ * Channel shuffling helpers for the 16-bit PCM input path.
+ *
+ * When every buffer is 4-byte aligned, two frames are moved per iteration with
+ * 32-bit loads and stores (both Xtensa and RISC-V ESP32 cores are little endian,
+ * so the first channel is the low half-word). Otherwise they fall back to a plain
+ * per-sample loop. None of them allocate.
+ */
+
+// Splits interleaved stereo into two planar channels
+void DeinterleaveStereo(const int16_t* input, int16_t* first, int16_t* second, size_t frames);
+
+// Merges two planar channels into interleaved stereo
+void InterleaveStereo(const int16_t* first, const int16_t* second, int16_t* output, size_t frames);
+
+// Keeps the first channel of interleaved stereo, the result is written to the front of data
+void ExtractFirstChannel(int16_t* data, size_t frames);
+
+// Scratch samples needed by ResampleInterleavedStereo() for the given input frames
+size_t ResampleInterleavedStereoScratchSize(OpusResampler& resampler, size_t frames);
+
+/*
+ * Resamples interleaved stereo in data with one resampler per channel, and writes the
+ * interleaved result back to data. data must have room for the larger of the input and
+ * the output. Returns the number of output frames.
+ */
+size_t ResampleInterleavedStereo(OpusResampler& first_resampler, OpusResampler& second_resampler,
+    int16_t* data, size_t frames, int16_t* scratch);
+
+#endif // AUDIO_CHANNEL_KERNELS_H
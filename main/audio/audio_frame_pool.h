@@ -0,0 +1,77 @@
+#ifndef AUDIO_FRAME_POOL_H
+#define AUDIO_FRAME_POOL_H
+
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+/*
+ * A fixed-capacity pool of preallocated audio objects (PCM tasks, Opus packets).
+ *
+ * Objects are created up front with their buffers reserved, so the steady state
+ * of the audio pipeline recycles the same memory instead of allocating a new
+ * vector for every 60ms frame. Acquire() falls back to the heap when the pool
+ * is exhausted, and Release() drops objects beyond the capacity.
+ */
+template <typename T>
+class AudioFramePool {
+public:
+    AudioFramePool() = default;
+    AudioFramePool(const AudioFramePool&) = delete;
+    AudioFramePool& operator=(const AudioFramePool&) = delete;
+
+    void Initialize(size_t capacity, std::function<void(T&)> reserve) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        reserve_ = reserve;
+        free_.clear();
+        free_.reserve(capacity_);
+        for (size_t i = 0; i < capacity_; i++) {
+            free_.push_back(Create());
+        }
+    }
+
+    std::unique_ptr<T> Acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                auto object = std::move(free_.back());
+                free_.pop_back();
+                return object;
+            }
+            allocations_++;
+        }
+        return Create();
+    }
+
+    void Release(std::unique_ptr<T> object) {
+        if (object == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < capacity_) {
+            free_.push_back(std::move(object));
+        }
+    }
+
+    // Number of objects allocated because the pool was empty
+    uint32_t allocations() const { return allocations_; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<T>> free_;
+    std::function<void(T&)> reserve_;
+    size_t capacity_ = 0;
+    uint32_t allocations_ = 0;
+
+    std::unique_ptr<T> Create() {
+        auto object = std::make_unique<T>();
+        if (reserve_) {
+            reserve_(*object);
+        }
+        return object;
+    }
+};
+
+#endif // AUDIO_FRAME_POOL_H
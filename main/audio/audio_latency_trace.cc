@@ -0,0 +1,151 @@
+#include "audio_latency_trace.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <cstdio>
+
+#define TAG "AudioLatency"
+
+struct AudioStageDefinition {
+    const char* name;
+    AudioTracePoint from;
+    AudioTracePoint to;
+};
+
+static const AudioStageDefinition kStages[kAudioStageCount] = {
+    {"process", kAudioTraceCapture, kAudioTraceProcessed},
+    {"encode", kAudioTraceProcessed, kAudioTraceEncoded},
+    {"send_wait", kAudioTraceEncoded, kAudioTraceSendQueued},
+    {"send_queue", kAudioTraceSendQueued, kAudioTraceSent},
+    {"uplink", kAudioTraceCapture, kAudioTraceSent},
+    {"decode", kAudioTraceReceived, kAudioTraceDecoded},
+    {"playback_queue", kAudioTraceDecoded, kAudioTracePlayback},
+    {"downlink", kAudioTraceReceived, kAudioTracePlayback},
+};
+
+static int GetBucket(uint32_t elapsed_us) {
+    uint32_t ms = elapsed_us / 1000;
+    if (ms == 0) {
+        return 0;
+    }
+    int bucket = 32 - __builtin_clz(ms);
+    return bucket < AUDIO_TRACE_HISTOGRAM_BUCKETS ? bucket : AUDIO_TRACE_HISTOGRAM_BUCKETS - 1;
+}
+
+void AudioLatencyTracer::Record(const AudioTraceStamps& stamps, AudioTracePoint point) {
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kAudioStageCount; i++) {
+        auto& stage = kStages[i];
+        if (stage.to != point || stamps.us[stage.from] == 0 || stamps.us[stage.to] == 0) {
+            continue;
+        }
+        uint32_t elapsed_us = stamps.us[stage.to] - stamps.us[stage.from];
+        auto& histogram = histograms_[i];
+        histogram.buckets[GetBucket(elapsed_us)]++;
+        histogram.count++;
+        histogram.total_us += elapsed_us;
+        if (elapsed_us > histogram.max_us) {
+            histogram.max_us = elapsed_us;
+        }
+    }
+#endif
+}
+
+void AudioCaptureTimeline::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    first_ = 0;
+    count_ = 0;
+    fed_ = 0;
+    output_ = 0;
+}
+
+void AudioCaptureTimeline::AddRead(size_t samples, uint32_t capture_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fed_ += samples;
+    reads_[(first_ + count_) % AUDIO_CAPTURE_TIMELINE_SIZE] = {fed_, capture_us};
+    if (count_ < AUDIO_CAPTURE_TIMELINE_SIZE) {
+        count_++;
+    } else {
+        // The oldest read was overwritten
+        first_ = (first_ + 1) % AUDIO_CAPTURE_TIMELINE_SIZE;
+    }
+}
+
+uint32_t AudioCaptureTimeline::TakeOutput(size_t samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    output_ += samples;
+    while (count_ > 0 && reads_[first_].end < output_) {
+        first_ = (first_ + 1) % AUDIO_CAPTURE_TIMELINE_SIZE;
+        count_--;
+    }
+    return count_ > 0 ? reads_[first_].capture_us : 0;
+}
+
+AudioStageHistogram AudioLatencyTracer::GetHistogram(AudioTraceStage stage) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return histograms_[stage];
+}
+
+void AudioLatencyTracer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& histogram : histograms_) {
+        histogram = AudioStageHistogram();
+    }
+}
+
+std::string AudioLatencyTracer::GetJson() {
+    /*
+     * {
+     *   "bucket_upper_ms": [1, 2, 4, ...],
+     *   "stages": {
+     *     "uplink": {"count": 10, "avg_us": 80000, "max_us": 95000, "histogram": [0, 0, ...]},
+     *     ...
+     *   }
+     * }
+     */
+    cJSON* root = cJSON_CreateObject();
+    cJSON* bounds = cJSON_CreateArray();
+    for (int i = 0; i < AUDIO_TRACE_HISTOGRAM_BUCKETS - 1; i++) {
+        cJSON_AddItemToArray(bounds, cJSON_CreateNumber(1 << i));
+    }
+    cJSON_AddItemToObject(root, "bucket_upper_ms", bounds);
+
+    cJSON* stages = cJSON_CreateObject();
+    for (int i = 0; i < kAudioStageCount; i++) {
+        auto histogram = GetHistogram(static_cast<AudioTraceStage>(i));
+        cJSON* stage = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage, "count", histogram.count);
+        cJSON_AddNumberToObject(stage, "avg_us", histogram.count > 0 ? histogram.total_us / histogram.count : 0);
+        cJSON_AddNumberToObject(stage, "max_us", histogram.max_us);
+        cJSON* buckets = cJSON_CreateArray();
+        for (int j = 0; j < AUDIO_TRACE_HISTOGRAM_BUCKETS; j++) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(histogram.buckets[j]));
+        }
+        cJSON_AddItemToObject(stage, "histogram", buckets);
+        cJSON_AddItemToObject(stages, kStages[i].name, stage);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void AudioLatencyTracer::Log() {
+    for (int i = 0; i < kAudioStageCount; i++) {
+        auto histogram = GetHistogram(static_cast<AudioTraceStage>(i));
+        if (histogram.count == 0) {
+            continue;
+        }
+        char buckets[AUDIO_TRACE_HISTOGRAM_BUCKETS * 11 + 1];
+        int length = 0;
+        for (int j = 0; j < AUDIO_TRACE_HISTOGRAM_BUCKETS; j++) {
+            length += snprintf(buckets + length, sizeof(buckets) - length, " %lu", (unsigned long)histogram.buckets[j]);
+        }
+        ESP_LOGI(TAG, "%-14s count=%lu avg=%lluus max=%luus histogram:%s", kStages[i].name, (unsigned long)histogram.count,
+            (unsigned long long)(histogram.total_us / histogram.count), (unsigned long)histogram.max_us, buckets);
+    }
+}
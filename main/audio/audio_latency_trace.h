@@ -0,0 +1,129 @@
+#ifndef AUDIO_LATENCY_TRACE_H
+#define AUDIO_LATENCY_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <esp_timer.h>
+
+// Points a frame passes through, stamped on the AudioTask / AudioStreamPacket carrying it
+enum AudioTracePoint {
+    kAudioTraceCapture,     // Microphone read that completed the frame
+    kAudioTraceProcessed,   // Audio processor (AFE) output
+    kAudioTraceEncoded,
+    kAudioTraceSendQueued,
+    kAudioTraceSent,        // Taken from the send queue by the network side
+    kAudioTraceReceived,    // Handed to the decode queue / jitter buffer
+    kAudioTraceDecoded,
+    kAudioTracePlayback,    // Written to the codec
+    kAudioTracePointCount
+};
+
+// Histograms are kept for the interval between two points
+enum AudioTraceStage {
+    kAudioStageProcess,         // Capture -> processed
+    kAudioStageEncode,          // Processed -> encoded
+    kAudioStageSendWait,        // Encoded -> send queued
+    kAudioStageSendQueue,       // Send queued -> sent
+    kAudioStageUplink,          // Capture -> sent
+    kAudioStageDecode,          // Received -> decoded
+    kAudioStagePlaybackQueue,   // Decoded -> playback
+    kAudioStageDownlink,        // Received -> playback
+    kAudioStageCount
+};
+
+// Bucket 0 is < 1ms, bucket i is [2^(i-1), 2^i) ms, the last one is open ended
+#define AUDIO_TRACE_HISTOGRAM_BUCKETS 12
+
+// Low 32 bits of esp_timer, 0 means not stamped. Intervals are computed modulo 2^32.
+// Empty unless CONFIG_USE_AUDIO_LATENCY_TRACE is enabled, the frames carry it with
+// [[no_unique_address]] so it then costs them nothing
+struct AudioTraceStamps {
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    uint32_t us[kAudioTracePointCount] = {};
+#endif
+
+    inline void Stamp(AudioTracePoint point) {
+        Set(point, static_cast<uint32_t>(esp_timer_get_time()));
+    }
+    // For a point that was timed before the frame existed, e.g. the capture of a processed frame
+    inline void Set(AudioTracePoint point, uint32_t stamp) {
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+        us[point] = stamp != 0 ? stamp : 1;
+#endif
+    }
+    inline void Clear() {
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+        for (auto& stamp : us) {
+            stamp = 0;
+        }
+#endif
+    }
+};
+
+#define AUDIO_CAPTURE_TIMELINE_SIZE 32
+
+/*
+ * Capture times of the reads fed into the audio processor, by sample position. The
+ * processor puts samples out in the order they were fed, so a processed frame gets the
+ * capture time of the read holding its last sample, even with several frames buffered.
+ *
+ * AddRead() is called by the audio input task, TakeOutput() by the processor output.
+ */
+class AudioCaptureTimeline {
+public:
+    void Reset();
+    void AddRead(size_t samples, uint32_t capture_us);
+    // Returns the capture time of the next samples put out, 0 if unknown
+    uint32_t TakeOutput(size_t samples);
+
+private:
+    struct Read {
+        uint64_t end = 0;   // Samples fed up to and including this read
+        uint32_t capture_us = 0;
+    };
+
+    std::mutex mutex_;
+    Read reads_[AUDIO_CAPTURE_TIMELINE_SIZE];
+    size_t first_ = 0;
+    size_t count_ = 0;
+    uint64_t fed_ = 0;
+    uint64_t output_ = 0;
+};
+
+struct AudioStageHistogram {
+    uint32_t buckets[AUDIO_TRACE_HISTOGRAM_BUCKETS] = {};
+    uint32_t count = 0;
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+};
+
+/*
+ * Aggregates the trace stamps of audio frames into per-stage latency histograms.
+ * Only compiled in with CONFIG_USE_AUDIO_LATENCY_TRACE, the stamps are no-ops otherwise.
+ */
+class AudioLatencyTracer {
+public:
+    static AudioLatencyTracer& GetInstance() {
+        static AudioLatencyTracer instance;
+        return instance;
+    }
+
+    // Records every stage that ends at point, for which both ends were stamped
+    void Record(const AudioTraceStamps& stamps, AudioTracePoint point);
+    AudioStageHistogram GetHistogram(AudioTraceStage stage);
+    void Reset();
+
+    std::string GetJson();
+    void Log();
+
+private:
+    AudioLatencyTracer() = default;
+
+    std::mutex mutex_;
+    AudioStageHistogram histograms_[kAudioStageCount];
+};
+
+#endif // AUDIO_LATENCY_TRACE_H
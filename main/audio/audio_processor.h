@@ -12,7 +12,9 @@ public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec, int frame_duration_ms) = 0;
-    virtual void Feed(std::vector<int16_t>&& data) = 0;
+    // Borrows data for the duration of the call. Its contents may be swapped for another
+    // preallocated buffer of any size, but it is never left moved-from.
+    virtual void Feed(std::vector<int16_t>& data) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
@@ -20,6 +22,8 @@ public:
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
+    // Whether OnVadStateChange() currently reports anything
+    virtual bool IsVadEnabled() = 0;
 };
 
 #endif
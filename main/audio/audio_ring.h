@@ -0,0 +1,128 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Slots beyond the capacity, one for each consumer that may be in the middle of a Pop()
+#define AUDIO_RING_SPARE_SLOTS 2
+
+/*
+ * A bounded, lock-free ring of owned objects for one hop of the audio pipeline.
+ *
+ * Like TaskRing in task_queue.h, every slot carries a sequence number that says whether
+ * it is free for the producer or filled for the consumer of a given position. Several
+ * producers and consumers may use the ring at once, e.g. Pop() on the codec task racing
+ * with Clear() from ResetDecoder().
+ *
+ * Push() only fails when the ring holds capacity objects. A consumer that has claimed a
+ * slot but not emptied it yet does not count, the spare slots keep the producer clear of
+ * it.
+ *
+ * The ring does not block. Wakeups are left to the owner, so that only the task
+ * waiting on this particular hop gets notified.
+ */
+template <typename T>
+class AudioRing {
+public:
+    explicit AudioRing(size_t capacity)
+        : slots_(new Slot[capacity + AUDIO_RING_SPARE_SLOTS]),
+        capacity_(capacity), slot_count_(capacity + AUDIO_RING_SPARE_SLOTS) {
+        for (size_t i = 0; i < slot_count_; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~AudioRing() {
+        Clear();
+    }
+
+    AudioRing(const AudioRing&) = delete;
+    AudioRing& operator=(const AudioRing&) = delete;
+
+    // On success the ring takes ownership of item, otherwise item is left untouched
+    bool Push(std::unique_ptr<T>&& item) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            intptr_t used = intptr_t(pos - dequeue_pos_.load(std::memory_order_acquire));
+            if (used >= intptr_t(capacity_)) {
+                return false;
+            }
+            slot = &slots_[pos % slot_count_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // A consumer stalled on this slot for a whole lap of the ring
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = item.release();
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::unique_ptr<T> Pop() {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos % slot_count_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        std::unique_ptr<T> item(slot->item);
+        slot->item = nullptr;
+        slot->sequence.store(pos + slot_count_, std::memory_order_release);
+        return item;
+    }
+
+    void Clear() {
+        while (Pop() != nullptr) {
+        }
+    }
+
+    size_t size() const {
+        // Load the consumer side first, so a concurrent Pop() can never make the result negative
+        size_t dequeue_pos = dequeue_pos_.load(std::memory_order_acquire);
+        return enqueue_pos_.load(std::memory_order_acquire) - dequeue_pos;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T* item = nullptr;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    const size_t capacity_;
+    const size_t slot_count_;
+    std::atomic<size_t> enqueue_pos_ = 0;
+    std::atomic<size_t> dequeue_pos_ = 0;
+};
+
+#endif // AUDIO_RING_H
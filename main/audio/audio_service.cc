@@ -1,6 +1,8 @@
 #include "audio_service.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
+#include <opus.h>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -36,14 +38,34 @@ void AudioService::Initialize(AudioCodec* codec) {
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_encoder_ = std::make_unique<OpusUplinkEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
     opus_encoder_->SetComplexity(0);
+#if CONFIG_USE_UPLINK_DTX
+    opus_encoder_->SetDtx(true);
+#endif
+    ApplyUplinkRateTarget();
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
 
+    /* Preallocate the frames recycled by the input, codec and output tasks */
+    size_t input_frame_samples = codec->input_sample_rate() * OPUS_FRAME_DURATION_MS / 1000;
+    size_t output_frame_samples = std::max(codec->output_sample_rate(), 24000) * OPUS_FRAME_DURATION_MS / 1000;
+    task_pool_.Initialize(AUDIO_TASK_POOL_SIZE, [output_frame_samples](AudioTask& task) {
+        task.pcm.reserve(output_frame_samples);
+    });
+    packet_pool_.Initialize(AUDIO_PACKET_POOL_SIZE, [](AudioStreamPacket& packet) {
+        packet.payload.reserve(AUDIO_PACKET_MAX_PAYLOAD_SIZE + AUDIO_PACKET_HEADROOM);
+    });
+    input_buffer_.reserve(input_frame_samples * codec->input_channels());
+    if (codec->input_sample_rate() != 16000) {
+        input_resample_scratch_.reserve(codec->input_channels() == 2 ?
+            ResampleInterleavedStereoScratchSize(input_resampler_, input_frame_samples) : input_frame_samples);
+    }
+    output_resample_buffer_.reserve(output_frame_samples);
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
@@ -61,7 +83,11 @@ void AudioService::Initialize(AudioCodec* codec) {
 #endif
 
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+        uint32_t capture_us = 0;
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+        capture_us = capture_timeline_.TakeOutput(data.size());
+#endif
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, data, capture_us);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
@@ -128,12 +154,35 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 3, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
+#if CONFIG_USE_SEPARATE_OPUS_TASKS
+#if CONFIG_OPUS_TASKS_PIN_TO_CORES
+    const BaseType_t encoder_core = 0;
+    const BaseType_t decoder_core = 1;
+#else
+    const BaseType_t encoder_core = tskNO_AFFINITY;
+    const BaseType_t decoder_core = tskNO_AFFINITY;
+#endif
+    /* Start the opus encoder and decoder tasks, so a slow frame in one direction does not stall the other */
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncoderTask();
+        vTaskDelete(NULL);
+    }, "opus_encoder", 2048 * 13, this, 2, &opus_encoder_task_handle_, encoder_core);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecoderTask();
+        vTaskDelete(NULL);
+    }, "opus_decoder", 2048 * 6, this, 2, &opus_decoder_task_handle_, decoder_core);
+#else
+    /* Start the opus codec task, which serves both the encoder and the decoder notifications */
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->OpusCodecTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_codec", 2048 * 13, this, 2, &opus_decoder_task_handle_);
+    opus_encoder_task_handle_ = opus_decoder_task_handle_;
+#endif
 }
 
 void AudioService::Stop() {
@@ -143,12 +192,26 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Clear();
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        sound_queue_.clear();
+        sound_reader_.Close();
+        sound_cached_.reset();
+        sound_capturing_ = false;
+        std::vector<int16_t>().swap(sound_capture_);
+        sound_playing_ = false;
+    }
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+
+    /* Wake up the tasks and any producer waiting for room, so they can see the service is stopped */
+    NotifyTask(opus_encoder_task_handle_);
+    NotifyTask(opus_decoder_task_handle_);
+    NotifyTask(audio_output_task_handle_);
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE | AS_EVENT_DECODE_QUEUE_AVAILABLE);
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -164,25 +227,16 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
             return false;
         }
         if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            size_t frames = data.size() / 2;
+            input_resample_scratch_.resize(ResampleInterleavedStereoScratchSize(input_resampler_, frames));
+            frames = ResampleInterleavedStereo(input_resampler_, reference_resampler_,
+                data.data(), frames, input_resample_scratch_.data());
+            data.resize(frames * 2);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
+            auto& resampled = input_resample_scratch_;
+            resampled.resize(input_resampler_.GetOutputSamples(data.size()));
             input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            data.assign(resampled.begin(), resampled.end());
         }
     } else {
         data.resize(samples * codec_->input_channels());
@@ -193,6 +247,9 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
 
     /* Update the last input time */
     last_input_time_ = std::chrono::steady_clock::now();
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    last_capture_us_ = static_cast<uint32_t>(esp_timer_get_time());
+#endif
     debug_statistics_.input_count++;
 
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -207,6 +264,12 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
 }
 
 void AudioService::AudioInputTask() {
+    /*
+     * input_buffer_ is only ever lent out by reference. The wake word and AFE paths just
+     * read it, while PushTaskToEncodeQueue (directly, or via NoAudioProcessor's output
+     * callback) swaps a pooled buffer into it, so it always holds preallocated storage.
+     */
+    auto& data = input_buffer_;
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
             AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
@@ -228,25 +291,20 @@ void AudioService::AudioInputTask() {
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                    ExtractFirstChannel(data.data(), data.size() / 2);
+                    data.resize(data.size() / 2);
                 }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, data, last_capture_us_);
                 continue;
             }
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
@@ -258,11 +316,13 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+                    capture_timeline_.AddRead(samples, last_capture_us_);
+#endif
+                    audio_processor_->Feed(data);
                     continue;
                 }
             }
@@ -277,22 +337,24 @@ void AudioService::AudioInputTask() {
 
 void AudioService::AudioOutputTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
+        auto task = audio_playback_queue_.Pop();
         if (service_stopped_) {
             break;
         }
-
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        if (task == nullptr) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        /* The playback queue has room again, the decoder may be waiting for it */
+        NotifyTask(opus_decoder_task_handle_);
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
+        task->trace.Stamp(kAudioTracePlayback);
+        AudioLatencyTracer::GetInstance().Record(task->trace, kAudioTracePlayback);
         codec_->OutputData(task->pcm);
 
         /* Update the last output time */
@@ -302,92 +364,305 @@ void AudioService::AudioOutputTask() {
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
+            std::lock_guard<std::mutex> lock(timestamp_mutex_);
             timestamp_queue_.push_back(task->timestamp);
         }
 #endif
+        task_pool_.Release(std::move(task));
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
 void AudioService::OpusCodecTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
-        if (service_stopped_) {
-            break;
+    while (!service_stopped_) {
+        bool decoded = DecodeNextPacket();
+        bool encoded = EncodeNextTask();
+        if (!decoded && !encoded) {
+            /* Woken by a push to the encode / decode queue, or a pop from the playback / send queue */
+            ulTaskNotifyTake(pdTRUE, GetDecoderWaitTicks());
         }
+    }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+    ESP_LOGW(TAG, "Opus codec task stopped");
+}
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
-            }
-            debug_statistics_.decode_count++;
-        }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
-            }
+void AudioService::OpusEncoderTask() {
+    while (!service_stopped_) {
+        if (!EncodeNextTask()) {
+            /* Woken by a push to the encode queue, or a pop from the send queue */
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+    ESP_LOGW(TAG, "Opus encoder task stopped");
+}
+
+void AudioService::OpusDecoderTask() {
+    while (!service_stopped_) {
+        if (!DecodeNextPacket()) {
+            /* Woken by a push to the decode queue, or a pop from the playback queue */
+            ulTaskNotifyTake(pdTRUE, GetDecoderWaitTicks());
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus decoder task stopped");
+}
+
+bool AudioService::DecodeNextPacket() {
+    if (audio_playback_queue_.size() >= MAX_PLAYBACK_TASKS_IN_QUEUE) {
+        return false;
+    }
+    // Local prompts go first, they are only played while the device is not streaming
+    std::unique_ptr<AudioStreamPacket> packet;
+    std::unique_ptr<AudioTask> cached_task;
+    bool from_sound = PopSoundFrame(packet, cached_task);
+    if (cached_task) {
+        // Cache hit, the PCM is already decoded at the output rate
+        PushTaskToPlaybackQueue(std::move(cached_task));
+        return true;
+    }
+    if (!packet) {
+        packet = audio_decode_queue_.Pop();
+        if (packet) {
+            xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
+        } else {
+            packet = jitter_buffer_.Get();
+            if (!packet) {
+                return false;
             }
+        }
+    }
+
+    auto start_time = esp_timer_get_time();
+    auto task = task_pool_.Acquire();
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+    task->timestamp = packet->timestamp;
+    task->trace = packet->trace;
+
+    SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+    // An empty payload comes from the jitter buffer for a lost packet, the decoder conceals it (PLC)
+    bool decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+    packet_pool_.Release(std::move(packet));
+    debug_statistics_.decode_count++;
+    if (!decoded) {
+        ESP_LOGE(TAG, "Failed to decode audio");
+        task_pool_.Release(std::move(task));
+        if (from_sound) {
+            CaptureSoundFrame(nullptr);
+        }
+        return true;
+    }
+
+    // Resample if the sample rate is different
+    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
+        output_resample_buffer_.resize(target_size);
+        output_resampler_.Process(task->pcm.data(), task->pcm.size(), output_resample_buffer_.data());
+        task->pcm.swap(output_resample_buffer_);
+    }
+    debug_statistics_.decode_timing.Record(esp_timer_get_time() - start_time);
+    task->trace.Stamp(kAudioTraceDecoded);
+    AudioLatencyTracer::GetInstance().Record(task->trace, kAudioTraceDecoded);
+    if (from_sound) {
+        CaptureSoundFrame(&task->pcm);
+    }
+
+    PushTaskToPlaybackQueue(std::move(task));
+    return true;
+}
+
+void AudioService::PushTaskToPlaybackQueue(std::unique_ptr<AudioTask> task) {
+    // Only fails if the queue is full, the output task notifies us when it takes a task out
+    while (!audio_playback_queue_.Push(std::move(task))) {
+        if (service_stopped_) {
+            task_pool_.Release(std::move(task));
+            return;
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    NotifyTask(audio_output_task_handle_);
+}
+
+bool AudioService::EncodeNextTask() {
+    if (audio_send_queue_.size() >= MAX_SEND_PACKETS_IN_QUEUE) {
+        return false;
+    }
+    auto task = audio_encode_queue_.Pop();
+    if (!task) {
+        return false;
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE);
+
+    auto start_time = esp_timer_get_time();
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    if (task->type == kAudioTaskTypeEncodeToSendQueue &&
+        uplink_rate_controller_.OnFrameQueued(audio_send_queue_.size(), MAX_SEND_PACKETS_IN_QUEUE, start_time / 1000)) {
+        ApplyUplinkRateTarget();
+    }
+#endif
+    auto packet = packet_pool_.Acquire();
+    packet->frame_duration = OPUS_FRAME_DURATION_MS;
+    packet->sample_rate = 16000;
+    packet->timestamp = task->timestamp;
+    packet->sequence = 0;
+    packet->trace = task->trace;
+    auto type = task->type;
+    // Only packets for the server get headroom, testing packets go straight to the decoder
+    packet->payload_offset = type == kAudioTaskTypeEncodeToSendQueue ? AUDIO_PACKET_HEADROOM : 0;
+    bool encoded = opus_encoder_->Encode(task->pcm, packet->payload, packet->payload_offset);
+    task_pool_.Release(std::move(task));
+    if (!encoded) {
+        ESP_LOGE(TAG, "Failed to encode audio");
+        packet_pool_.Release(std::move(packet));
+        return true;
+    }
+    debug_statistics_.encode_timing.Record(esp_timer_get_time() - start_time);
+    packet->trace.Stamp(kAudioTraceEncoded);
+    AudioLatencyTracer::GetInstance().Record(packet->trace, kAudioTraceEncoded);
+
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+#if CONFIG_USE_UPLINK_DTX
+        if (HoldBackSilentPacket(packet)) {
             debug_statistics_.encode_count++;
-            lock.lock();
+            return true;
+        }
+#endif
+        PushPacketToSendQueue(std::move(packet));
+    } else if (type == kAudioTaskTypeEncodeToTestingQueue) {
+        if (!audio_testing_queue_.Push(std::move(packet))) {
+            ESP_LOGW(TAG, "Audio testing queue is full, dropping packet");
         }
     }
+    debug_statistics_.encode_count++;
+    return true;
+}
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+void AudioService::PushPacketToSendQueue(std::unique_ptr<AudioStreamPacket> packet) {
+    packet->trace.Stamp(kAudioTraceSendQueued);
+    AudioLatencyTracer::GetInstance().Record(packet->trace, kAudioTraceSendQueued);
+    // Only fails if the queue is full, PopPacketFromSendQueue() notifies us when it takes one out
+    while (!audio_send_queue_.Push(std::move(packet))) {
+        if (service_stopped_) {
+            packet_pool_.Release(std::move(packet));
+            return;
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    if (callbacks_.on_send_queue_available) {
+        callbacks_.on_send_queue_available();
+    }
+}
+
+/*
+ * Decides whether an encoded uplink frame is sent now. Returns true if the packet was
+ * kept back or recycled instead.
+ *
+ * A frame is silent when the processor VAD says nobody is speaking, or when Opus DTX
+ * coded it as an empty packet (the only hint left while device AEC turns the VAD off).
+ * Without the VAD, the full size comfort noise update that DTX sends about every 400ms
+ * also counts as silent: a single full packet inside a DTX run is taken for one, and
+ * only a second full packet in a row ends the run. The first one is held back with the
+ * rest, so the onset of speech still goes out, one frame later.
+ * After UPLINK_DTX_HANGOVER_FRAMES silent frames, only every UPLINK_DTX_KEEPALIVE_FRAMES-th
+ * one goes out, which carries comfort noise and keeps the server AEC timeline moving.
+ * The others wait in a short holdback, so the onset of speech that the VAD reports a
+ * little late is still sent. Every packet keeps its own timestamp.
+ */
+bool AudioService::HoldBackSilentPacket(std::unique_ptr<AudioStreamPacket>& packet) {
+    if (uplink_dtx_reset_.exchange(false)) {
+        debug_statistics_.dtx_skipped_count += uplink_dtx_holdback_.size();
+        for (auto& held : uplink_dtx_holdback_) {
+            packet_pool_.Release(std::move(held));
+        }
+        uplink_dtx_holdback_.clear();
+        uplink_silent_frames_ = 0;
+        uplink_in_dtx_ = false;
+        uplink_cn_update_ = false;
+    }
+
+    bool dtx_packet = packet->payload_size() <= OPUS_DTX_PACKET_MAX_SIZE;
+    bool silent;
+    if (audio_processor_->IsVadEnabled()) {
+        silent = dtx_packet || !voice_detected_;
+    } else if (dtx_packet) {
+        uplink_in_dtx_ = true;
+        uplink_cn_update_ = false;
+        silent = true;
+    } else if (uplink_in_dtx_ && !uplink_cn_update_) {
+        uplink_cn_update_ = true;
+        silent = true;
+    } else {
+        uplink_in_dtx_ = false;
+        uplink_cn_update_ = false;
+        silent = false;
+    }
+    if (!silent) {
+        uplink_silent_frames_ = 0;
+        while (!uplink_dtx_holdback_.empty()) {
+            PushPacketToSendQueue(std::move(uplink_dtx_holdback_.front()));
+            uplink_dtx_holdback_.pop_front();
+        }
+        return false;
+    }
+
+    uplink_silent_frames_++;
+    if (uplink_silent_frames_ <= UPLINK_DTX_HANGOVER_FRAMES ||
+        (uplink_silent_frames_ - UPLINK_DTX_HANGOVER_FRAMES) % UPLINK_DTX_KEEPALIVE_FRAMES == 0) {
+        // Older held frames would arrive out of order after this one, drop them
+        debug_statistics_.dtx_skipped_count += uplink_dtx_holdback_.size();
+        for (auto& held : uplink_dtx_holdback_) {
+            packet_pool_.Release(std::move(held));
+        }
+        uplink_dtx_holdback_.clear();
+        return false;
+    }
+
+    if (uplink_dtx_holdback_.size() >= UPLINK_DTX_PREROLL_FRAMES) {
+        debug_statistics_.dtx_skipped_count++;
+        packet_pool_.Release(std::move(uplink_dtx_holdback_.front()));
+        uplink_dtx_holdback_.pop_front();
+    }
+    uplink_dtx_holdback_.push_back(std::move(packet));
+    return true;
+}
+
+void AudioService::ApplyUplinkRateTarget() {
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    auto target = uplink_rate_controller_.target();
+    opus_encoder_->SetBitrate(target.bitrate);
+    opus_encoder_->SetInbandFec(target.fec, target.loss_percent);
+#endif
+}
+
+void AudioService::SetUplinkBitrateRange(int min_bitrate, int max_bitrate) {
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    uplink_rate_controller_.SetBounds(min_bitrate, max_bitrate);
+    if (opus_encoder_) {
+        ApplyUplinkRateTarget();
+    }
+#endif
+}
+
+void AudioService::ReportLink(uint32_t rtt_ms, uint32_t downlink_loss_percent) {
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    uplink_rate_controller_.OnLinkReport(rtt_ms, downlink_loss_percent);
+#endif
+}
+
+void AudioService::ReportUplinkLoss(uint32_t loss_percent) {
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    uplink_rate_controller_.OnUplinkLoss(loss_percent);
+#endif
+}
+
+void AudioService::ConnectLinkFeedback(Protocol& protocol) {
+    protocol.OnLinkReport([this](uint32_t rtt_ms, uint32_t downlink_loss_percent) {
+        ReportLink(rtt_ms, downlink_loss_percent);
+    });
+    protocol.OnUplinkBitrateRange([this](int min_bitrate, int max_bitrate) {
+        SetUplinkBitrateRange(min_bitrate, max_bitrate);
+    });
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
@@ -405,51 +680,88 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
+TickType_t AudioService::GetDecoderWaitTicks() {
+    // The jitter buffer releases packets on a timer (prebuffering, playout deadline), so poll while it holds any
+    return jitter_buffer_.empty() ? portMAX_DELAY : pdMS_TO_TICKS(JITTER_BUFFER_POLL_MS);
+}
+
+void AudioService::NotifyTask(TaskHandle_t task) {
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>& pcm, uint32_t capture_us) {
+    auto task = task_pool_.Acquire();
     task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    task->timestamp = 0;
+    // Swap instead of move, so the producer gets a preallocated buffer back for its next frame
+    task->pcm.swap(pcm);
+    task->trace.Clear();
+    if (capture_us != 0) {
+        task->trace.Set(kAudioTraceCapture, capture_us);
+    }
+    task->trace.Stamp(kAudioTraceProcessed);
+    AudioLatencyTracer::GetInstance().Record(task->trace, kAudioTraceProcessed);
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        if (!timestamp_queue_.empty()) {
+            if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
+                task->timestamp = timestamp_queue_.front();
+            } else {
+                ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+            }
+            timestamp_queue_.pop_front();
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    /* Push the task to the encode queue, waiting for the codec task if it is full */
+    while (!audio_encode_queue_.Push(std::move(task))) {
+        if (service_stopped_) {
+            task_pool_.Release(std::move(task));
+            return;
+        }
+        xEventGroupWaitBits(event_group_, AS_EVENT_ENCODE_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
+    }
+    NotifyTask(opus_encoder_task_handle_);
 }
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+    packet->trace.Clear();
+    packet->trace.Stamp(kAudioTraceReceived);
+    if (packet->sequence != 0) {
+        jitter_buffer_.Put(std::move(packet));
+        NotifyTask(opus_decoder_task_handle_);
+        return true;
+    }
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            if (audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE && audio_decode_queue_.Push(std::move(packet))) {
+                break;
+            }
+        }
+        if (!wait || service_stopped_) {
+            packet_pool_.Release(std::move(packet));
             return false;
         }
+        xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    NotifyTask(opus_decoder_task_handle_);
     return true;
 }
 
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
-        return nullptr;
+    auto packet = audio_send_queue_.Pop();
+    if (packet) {
+        packet->trace.Stamp(kAudioTraceSent);
+        AudioLatencyTracer::GetInstance().Record(packet->trace, kAudioTraceSent);
+        /* The send queue has room again, the encoder may be waiting for it */
+        NotifyTask(opus_encoder_task_handle_);
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
     return packet;
 }
 
@@ -464,10 +776,17 @@ const std::string& AudioService::GetLastWakeWord() const {
 }
 
 std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
-    auto packet = std::make_unique<AudioStreamPacket>();
+    auto packet = packet_pool_.Acquire();
+    packet->sample_rate = 16000;
+    packet->frame_duration = OPUS_FRAME_DURATION_MS;
+    packet->timestamp = 0;
+    packet->sequence = 0;
+    packet->payload_offset = 0;
+    packet->trace.Clear();
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
         return packet;
     }
+    packet_pool_.Release(std::move(packet));
     return nullptr;
 }
 
@@ -504,6 +823,11 @@ void AudioService::EnableVoiceProcessing(bool enable) {
         /* We should make sure no audio is playing */
         ResetDecoder();
         audio_input_need_warmup_ = true;
+        // A new listening session starts with the hangover, not with frames held from the last one
+        uplink_dtx_reset_ = true;
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+        capture_timeline_.Reset();
+#endif
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
@@ -518,10 +842,15 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Move audio_testing_queue_ to audio_decode_queue_ */
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            audio_decode_queue_.Clear();
+            while (auto packet = audio_testing_queue_.Pop()) {
+                audio_decode_queue_.Push(std::move(packet));
+            }
+        }
+        NotifyTask(opus_decoder_task_handle_);
     }
 }
 
@@ -540,111 +869,112 @@ void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
 }
 
 void AudioService::PlaySound(const std::string_view& ogg) {
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
-        }
-        return static_cast<size_t>(-1);
-    };
-
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        sound_queue_.push_back(ogg);
+    }
+    NotifyTask(opus_decoder_task_handle_);
+}
 
+bool AudioService::PopSoundFrame(std::unique_ptr<AudioStreamPacket>& packet, std::unique_ptr<AudioTask>& task) {
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    std::string_view payload;
     while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
-            }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
+        if (sound_cached_) {
+            if (sound_cached_offset_ < sound_cached_->samples) {
+                size_t frame_samples = codec_->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000;
+                size_t samples = std::min(frame_samples, sound_cached_->samples - sound_cached_offset_);
+                const int16_t* pcm = sound_cached_->pcm + sound_cached_offset_;
+                sound_cached_offset_ += samples;
+                task = task_pool_.Acquire();
+                task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+                task->timestamp = 0;
+                task->trace.Clear();
+                task->pcm.assign(pcm, pcm + samples);
+                return true;
             }
+            sound_cached_.reset();
+        } else if (sound_reader_.NextPacket(payload)) {
+            break;
+        } else if (sound_capturing_) {
+            // Every packet of the sound has been decoded and captured
+            sound_cache_.Insert(sound_current_, codec_->output_sample_rate(), sound_capture_);
+            sound_capturing_ = false;
+            std::vector<int16_t>().swap(sound_capture_);
+        }
 
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
+        if (sound_queue_.empty()) {
+            sound_playing_ = false;
+            return false;
+        }
+        sound_current_ = sound_queue_.front();
+        sound_queue_.pop_front();
+        sound_playing_ = true;
+        sound_cached_ = sound_cache_.Find(sound_current_, codec_->output_sample_rate());
+        sound_cached_offset_ = 0;
+        if (!sound_cached_) {
+            sound_reader_.Open(sound_current_);
+            sound_capturing_ = sound_cache_.enabled();
         }
+    }
+
+    // The decoder takes its input by vector, so the payload is copied into a pooled packet
+    packet = packet_pool_.Acquire();
+    packet->sample_rate = sound_reader_.sample_rate();
+    int samples = opus_packet_get_nb_samples(reinterpret_cast<const unsigned char*>(payload.data()), payload.size(), 48000);
+    packet->frame_duration = samples > 0 ? samples / 48 : OPUS_FRAME_DURATION_MS;
+    packet->timestamp = 0;
+    packet->sequence = 0;
+    packet->payload_offset = 0;
+    packet->trace.Clear();
+    packet->payload.assign(payload.begin(), payload.end());
+    return true;
+}
 
-        offset = body_off + body_size;
+void AudioService::CaptureSoundFrame(const std::vector<int16_t>* pcm) {
+    std::lock_guard<std::mutex> lock(sound_mutex_);
+    if (!sound_capturing_) {
+        return;
+    }
+    // Give up on sounds that failed to decode or are too long to be worth caching
+    if (pcm == nullptr || (sound_capture_.size() + pcm->size()) * sizeof(int16_t) > sound_cache_.max_entry_bytes()) {
+        sound_capturing_ = false;
+        std::vector<int16_t>().swap(sound_capture_);
+        return;
     }
+    sound_capture_.insert(sound_capture_.end(), pcm->begin(), pcm->end());
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        if (sound_playing_ || !sound_queue_.empty()) {
+            return false;
+        }
+    }
+    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && jitter_buffer_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        sound_queue_.clear();
+        sound_reader_.Close();
+        sound_cached_.reset();
+        sound_capturing_ = false;
+        std::vector<int16_t>().swap(sound_capture_);
+        sound_playing_ = false;
+    }
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_AVAILABLE);
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -3,21 +3,30 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
+#include <algorithm>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
 
-#include <opus_encoder.h>
 #include <opus_decoder.h>
 #include <opus_resampler.h>
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "audio_channel_kernels.h"
+#include "audio_frame_pool.h"
+#include "audio_latency_trace.h"
+#include "audio_ring.h"
+#include "jitter_buffer.h"
+#include "opus_uplink_encoder.h"
+#include "uplink_rate_controller.h"
+#include "ogg_demuxer.h"
+#include "sound_cache.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
@@ -26,12 +35,21 @@
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Decode Queue / Jitter Buffer} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
  *
  * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * With CONFIG_USE_SEPARATE_OPUS_TASKS the encoder and decoder run on two tasks instead,
+ * so that in full duplex (realtime) mode a slow frame in one direction does not delay the other.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
- * 
+ *
+ * Packets from unordered transports (those with a sequence number, i.e. UDP) go through the jitter buffer,
+ * which reorders them and conceals the lost ones, instead of the decode queue.
+ *
+ * Each queue is a lock-free AudioRing. Instead of one shared condition variable, a push or pop
+ * only wakes the task on the other side of that hop: the consumer task through a task notification,
+ * and a blocked producer through the matching AS_EVENT_*_QUEUE_AVAILABLE bit, or through a task
+ * notification when the producer is the codec task itself (send and playback queues).
  */
 
 #define OPUS_FRAME_DURATION_MS 60
@@ -41,6 +59,22 @@
 #define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+#define MAX_TESTING_PACKETS_IN_QUEUE (AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS + MAX_ENCODE_TASKS_IN_QUEUE)
+// Tasks in the encode / playback queues plus one in flight on each of the input, codec and output tasks
+#define AUDIO_TASK_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + MAX_PLAYBACK_TASKS_IN_QUEUE + 3)
+// Uplink packets in the send queue and on their way out, plus the downlink packets a jitter
+// buffer at its usual delay holds
+#define AUDIO_PACKET_POOL_SIZE 16
+#define AUDIO_PACKET_MAX_PAYLOAD_SIZE 1000
+
+// Uplink DTX: frames still sent after speech ends, one comfort noise frame kept every
+// UPLINK_DTX_KEEPALIVE_FRAMES, and silent frames held back to be sent when speech starts
+#define UPLINK_DTX_HANGOVER_FRAMES (300 / OPUS_FRAME_DURATION_MS)
+#define UPLINK_DTX_KEEPALIVE_FRAMES (420 / OPUS_FRAME_DURATION_MS)
+#define UPLINK_DTX_PREROLL_FRAMES (180 / OPUS_FRAME_DURATION_MS)
+
+// How often the decoder checks a jitter buffer that holds packets which are not ready yet
+#define JITTER_BUFFER_POLL_MS 10
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -50,6 +84,8 @@
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_ENCODE_QUEUE_AVAILABLE     (1 << 4)
+#define AS_EVENT_DECODE_QUEUE_AVAILABLE     (1 << 5)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
@@ -68,7 +104,23 @@ enum AudioTaskType {
 struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
-    uint32_t timestamp;
+    uint32_t timestamp = 0;
+    [[no_unique_address]] AudioTraceStamps trace;
+};
+
+struct AudioStageTiming {
+    uint32_t count = 0;
+    uint32_t last_us = 0;
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+
+    void Record(int64_t elapsed_us) {
+        last_us = elapsed_us;
+        max_us = std::max(max_us, last_us);
+        total_us += last_us;
+        count++;
+    }
+    uint32_t average_us() const { return count > 0 ? total_us / count : 0; }
 };
 
 struct DebugStatistics {
@@ -76,6 +128,9 @@ struct DebugStatistics {
     uint32_t decode_count = 0;
     uint32_t encode_count = 0;
     uint32_t playback_count = 0;
+    uint32_t dtx_skipped_count = 0;
+    AudioStageTiming encode_timing;
+    AudioStageTiming decode_timing;
 };
 
 class AudioService {
@@ -103,9 +158,20 @@ public:
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    // Queues an Ogg Opus sound and returns immediately, the data must outlive its playback
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    JitterBufferStatistics GetJitterBufferStatistics() { return jitter_buffer_.statistics(); }
+    const DebugStatistics& debug_statistics() const { return debug_statistics_; }
+    // Bounds agreed with the server and link feedback for the uplink bitrate controller,
+    // ignored unless CONFIG_USE_ADAPTIVE_UPLINK_BITRATE is enabled
+    void SetUplinkBitrateRange(int min_bitrate, int max_bitrate);
+    void ReportLink(uint32_t rtt_ms, uint32_t downlink_loss_percent);
+    void ReportUplinkLoss(uint32_t loss_percent);
+    // Feeds the protocol's hello round trip, UDP downlink loss and agreed bitrate range to
+    // the above, called by the owner once it has created the protocol
+    void ConnectLinkFeedback(Protocol& protocol);
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -113,44 +179,100 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<OpusUplinkEncoder> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    UplinkRateController uplink_rate_controller_{CONFIG_UPLINK_OPUS_MIN_BITRATE, CONFIG_UPLINK_OPUS_MAX_BITRATE};
+#endif
     DebugStatistics debug_statistics_;
 
+    // Preallocated frames recycled by the input, codec and output tasks
+    AudioFramePool<AudioTask> task_pool_;
+    // Shared with the transports, which return sent packets and take received ones from it
+    AudioPacketPool& packet_pool_ = AudioPacketPool::GetInstance();
+    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t> input_resample_scratch_;
+    std::vector<int16_t> output_resample_buffer_;
+
     EventGroupHandle_t event_group_;
 
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    // Both handles point to the same task unless CONFIG_USE_SEPARATE_OPUS_TASKS is enabled
+    TaskHandle_t opus_encoder_task_handle_ = nullptr;
+    TaskHandle_t opus_decoder_task_handle_ = nullptr;
+    // The decode queue has several producers (network, audio testing) and its ring is larger than
+    // MAX_DECODE_PACKETS_IN_QUEUE, so the size check and the push are kept together
+    std::mutex decode_producer_mutex_;
+    // The decode queue can hold the whole audio testing recording, MAX_DECODE_PACKETS_IN_QUEUE is enforced on push
+    AudioRing<AudioStreamPacket> audio_decode_queue_{MAX_TESTING_PACKETS_IN_QUEUE};
+    AudioRing<AudioStreamPacket> audio_send_queue_{MAX_SEND_PACKETS_IN_QUEUE};
+    AudioRing<AudioStreamPacket> audio_testing_queue_{MAX_TESTING_PACKETS_IN_QUEUE};
+    AudioRing<AudioTask> audio_encode_queue_{MAX_ENCODE_TASKS_IN_QUEUE};
+    AudioRing<AudioTask> audio_playback_queue_{MAX_PLAYBACK_TASKS_IN_QUEUE};
     // For server AEC
+    std::mutex timestamp_mutex_;
     std::deque<uint32_t> timestamp_queue_;
+    JitterBuffer jitter_buffer_{MAX_DECODE_PACKETS_IN_QUEUE};
+    // Sounds waiting for PlaySound playback, fed to the decoder one packet at a time
+    std::mutex sound_mutex_;
+    std::deque<std::string_view> sound_queue_;
+    OggOpusReader sound_reader_;
+    bool sound_playing_ = false;
+    std::string_view sound_current_;
+    // Decoded PCM of prompts, filled while an uncached sound plays for the first time
+    SoundCache sound_cache_{CONFIG_SOUND_CACHE_SIZE_KB * 1024};
+    std::shared_ptr<const SoundCacheEntry> sound_cached_;
+    size_t sound_cached_offset_ = 0;
+    bool sound_capturing_ = false;
+    std::vector<int16_t> sound_capture_;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
-    bool voice_detected_ = false;
+    std::atomic<bool> voice_detected_ = false;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
+    // Uplink DTX state, owned by the encoder task
+    std::deque<std::unique_ptr<AudioStreamPacket>> uplink_dtx_holdback_;
+    int uplink_silent_frames_ = 0;
+    // Opus DTX state for when the VAD is off: inside a run of DTX packets, and whether the run
+    // has just had its full size comfort noise update
+    bool uplink_in_dtx_ = false;
+    bool uplink_cn_update_ = false;
+    std::atomic<bool> uplink_dtx_reset_ = false;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
     std::chrono::steady_clock::time_point last_output_time_;
+    // Capture stamp of the latest microphone read
+    uint32_t last_capture_us_ = 0;
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    AudioCaptureTimeline capture_timeline_;
+#endif
 
     void AudioInputTask();
     void AudioOutputTask();
     void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void OpusEncoderTask();
+    void OpusDecoderTask();
+    bool EncodeNextTask();
+    void ApplyUplinkRateTarget();
+    void PushPacketToSendQueue(std::unique_ptr<AudioStreamPacket> packet);
+    bool HoldBackSilentPacket(std::unique_ptr<AudioStreamPacket>& packet);
+    bool DecodeNextPacket();
+    bool PopSoundFrame(std::unique_ptr<AudioStreamPacket>& packet, std::unique_ptr<AudioTask>& task);
+    void CaptureSoundFrame(const std::vector<int16_t>* pcm);
+    void PushTaskToPlaybackQueue(std::unique_ptr<AudioTask> task);
+    // Takes the samples out of pcm and leaves a pooled buffer in their place.
+    // capture_us is the time the samples were read, 0 if unknown
+    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>& pcm, uint32_t capture_us);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void NotifyTask(TaskHandle_t task);
+    TickType_t GetDecoderWaitTicks();
     void CheckAndUpdateAudioPowerState();
 };
 
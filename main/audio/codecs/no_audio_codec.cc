@@ -3,6 +3,7 @@
 #include <esp_log.h>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 
 #define TAG "NoAudioCodec"
 
@@ -278,42 +279,63 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     ESP_LOGI(TAG, "Simplex channels created");
 }
 
+void NoAudioCodec::UpdateVolumeFactor() {
+    // output_volume_: 0-100
+    // volume_factor_: 0-65536
+    volume_factor_ = pow(double(output_volume_) / 100.0, 2) * 65536;
+}
+
+void NoAudioCodec::SetOutputVolume(int volume) {
+    AudioCodec::SetOutputVolume(volume);
+    std::lock_guard<std::mutex> lock(data_if_mutex_);
+    UpdateVolumeFactor();
+}
+
+void NoAudioCodec::Start() {
+    // The stored volume is loaded here, refresh the gain before the first write
+    AudioCodec::Start();
+    std::lock_guard<std::mutex> lock(data_if_mutex_);
+    UpdateVolumeFactor();
+}
+
 int NoAudioCodec::Write(const int16_t* data, int samples) {
     std::lock_guard<std::mutex> lock(data_if_mutex_);
-    std::vector<int32_t> buffer(samples);
+    if (write_buffer_.size() < size_t(samples)) {
+        write_buffer_.resize(samples);
+    }
 
-    // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
+    /*
+     * |data[i]| <= 32768 and volume_factor_ <= 65536, so the product stays within
+     * [INT32_MIN, INT32_MAX] and a 32-bit multiply never needs clamping.
+     */
+    int32_t* buffer = write_buffer_.data();
+    const int32_t volume_factor = volume_factor_;
     for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+        buffer[i] = int32_t(data[i]) * volume_factor;
     }
 
     size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer, samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    if (read_buffer_.size() < size_t(samples)) {
+        read_buffer_.resize(samples);
+    }
+    int32_t* bit32_buffer = read_buffer_.data();
+    if (i2s_channel_read(rx_handle_, bit32_buffer, samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     samples = bytes_read / sizeof(int32_t);
     for (int i = 0; i < samples; i++) {
+        // min/max map to single instructions, unlike the compare-and-branch chain
         int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+        dest[i] = std::min<int32_t>(std::max<int32_t>(value, -INT16_MAX), INT16_MAX);
     }
     return samples;
 }
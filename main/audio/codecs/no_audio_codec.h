@@ -6,16 +6,25 @@
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
 #include <mutex>
+#include <vector>
 
 class NoAudioCodec : public AudioCodec {
 protected:
     std::mutex data_if_mutex_;
+    // Q16 output gain derived from output_volume_, refreshed only when the volume changes
+    int32_t volume_factor_ = 0;
+    // 32-bit I2S slot buffers, reused across calls
+    std::vector<int32_t> write_buffer_;
+    std::vector<int32_t> read_buffer_;
 
+    void UpdateVolumeFactor();
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
 public:
     virtual ~NoAudioCodec();
+    virtual void SetOutputVolume(int volume) override;
+    virtual void Start() override;
 };
 
 class NoAudioCodecDuplex : public NoAudioCodec {
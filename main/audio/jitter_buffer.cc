@@ -0,0 +1,210 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "JitterBuffer"
+
+JitterBuffer::JitterBuffer(size_t capacity) : slots_(capacity) {
+}
+
+// Serial number arithmetic (RFC 1982), positive if a comes after b
+static inline int32_t SequenceDiff(uint32_t a, uint32_t b) {
+    return int32_t(a - b);
+}
+
+void JitterBuffer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReleaseAll();
+    started_ = false;
+    playing_ = false;
+    last_arrival_ms_ = 0;
+    ran_dry_ms_ = 0;
+}
+
+std::unique_ptr<AudioStreamPacket>& JitterBuffer::SlotOf(uint32_t sequence) {
+    // Signed, so a packet reordered in front of the origin gets the slot before it
+    int32_t size = slots_.size();
+    int32_t index = SequenceDiff(sequence, origin_sequence_) % size;
+    return slots_[index < 0 ? index + size : index];
+}
+
+void JitterBuffer::ReleaseAll() {
+    for (auto& slot : slots_) {
+        AudioPacketPool::GetInstance().Release(std::move(slot));
+    }
+    buffered_ = 0;
+}
+
+// Starts the stream over at sequence, prebuffering again
+void JitterBuffer::Restart(uint32_t sequence) {
+    ReleaseAll();
+    started_ = true;
+    playing_ = false;
+    next_sequence_ = sequence;
+    origin_sequence_ = sequence;
+    last_sequence_ = sequence;
+    last_arrival_ms_ = 0;
+}
+
+bool JitterBuffer::empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffered_ == 0;
+}
+
+JitterBufferStatistics JitterBuffer::statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.jitter_ms = jitter_q4_ / 16;
+    statistics_.target_delay_ms = TargetDelayMs();
+    return statistics_;
+}
+
+uint32_t JitterBuffer::TargetDelayMs() const {
+    int frame_duration = frame_duration_ > 0 ? frame_duration_ : JITTER_BUFFER_MIN_DELAY_MS;
+    uint32_t delay = frame_duration + 3 * jitter_q4_ / 16;
+    uint32_t max_delay = std::min<uint32_t>(JITTER_BUFFER_MAX_DELAY_MS, slots_.size() * frame_duration / 2);
+    return std::clamp<uint32_t>(delay, JITTER_BUFFER_MIN_DELAY_MS, max_delay);
+}
+
+void JitterBuffer::Put(std::unique_ptr<AudioStreamPacket> packet) {
+    int64_t now = esp_timer_get_time() / 1000;
+    uint32_t sequence = packet->sequence;
+    size_t capacity = slots_.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.received_count++;
+    sample_rate_ = packet->sample_rate;
+    frame_duration_ = packet->frame_duration;
+
+    int32_t offset = SequenceDiff(sequence, next_sequence_);
+    if (!started_) {
+        Restart(sequence);
+        offset = 0;
+    } else if (offset <= -int32_t(capacity)) {
+        // Far behind anything we could still play, the server restarted its sequence
+        ESP_LOGW(TAG, "Packet %lu is far behind %lu, restarting the stream", sequence, next_sequence_);
+        Restart(sequence);
+        offset = 0;
+    } else if (!playing_ && buffered_ > 0 && offset < 0 && SequenceDiff(last_sequence_, sequence) < int32_t(capacity)) {
+        // Reordered before playback started, move the start back
+        next_sequence_ = sequence;
+        offset = 0;
+    }
+
+    if (ran_dry_ms_ != 0) {
+        // Playback starved only if the stream went on right after the buffer ran dry. A packet
+        // arriving much later starts the next utterance, and a stream that ended sends none
+        if (offset >= 0 && offset < int32_t(capacity) && now - ran_dry_ms_ < JITTER_BUFFER_MAX_DELAY_MS) {
+            statistics_.underrun_count++;
+        }
+        ran_dry_ms_ = 0;
+    }
+
+    if (offset < 0) {
+        statistics_.late_count++;
+        ESP_LOGD(TAG, "Late packet %lu, expected %lu", sequence, next_sequence_);
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+        return;
+    }
+    if (offset >= int32_t(capacity)) {
+        // Too far ahead, drop what is in the way
+        ESP_LOGW(TAG, "Packet %lu is too far ahead of %lu, skipping", sequence, next_sequence_);
+        uint32_t new_next = sequence - capacity + 1;
+        if (SequenceDiff(new_next, next_sequence_) >= int32_t(capacity)) {
+            // A jump, e.g. a restarted stream, everything buffered is in the way
+            ReleaseAll();
+        } else {
+            for (; next_sequence_ != new_next; next_sequence_++) {
+                auto& slot = SlotOf(next_sequence_);
+                if (slot) {
+                    AudioPacketPool::GetInstance().Release(std::move(slot));
+                    buffered_--;
+                }
+            }
+        }
+        next_sequence_ = new_next;
+    }
+
+    // RFC 3550 inter-arrival jitter, in units of 1/16 ms
+    if (last_arrival_ms_ != 0 && SequenceDiff(sequence, last_sequence_) > 0) {
+        int64_t expected = int64_t(sequence - last_sequence_) * frame_duration_;
+        int64_t deviation = std::llabs((now - last_arrival_ms_) - expected);
+        int32_t delta = int32_t(deviation * 16) - int32_t(jitter_q4_);
+        jitter_q4_ = uint32_t(int32_t(jitter_q4_) + delta / 16);
+    }
+    if (SequenceDiff(sequence, last_sequence_) >= 0 || last_arrival_ms_ == 0) {
+        last_sequence_ = sequence;
+        last_arrival_ms_ = now;
+    }
+
+    auto& slot = SlotOf(sequence);
+    if (slot) {
+        // Duplicate
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+        return;
+    }
+    if (buffered_ == 0) {
+        first_buffered_ms_ = now;
+    }
+    slot = std::move(packet);
+    buffered_++;
+}
+
+std::unique_ptr<AudioStreamPacket> JitterBuffer::TakeNext() {
+    auto& slot = SlotOf(next_sequence_);
+    next_sequence_++;
+    if (slot) {
+        buffered_--;
+        return std::move(slot);
+    }
+
+    // Lost or still on its way, conceal it
+    statistics_.concealed_count++;
+    auto packet = AudioPacketPool::GetInstance().Acquire();
+    packet->sample_rate = sample_rate_;
+    packet->frame_duration = frame_duration_;
+    packet->timestamp = 0;
+    packet->sequence = 0;
+    packet->trace.Clear();
+    packet->payload.clear();
+    packet->payload_offset = 0;
+    return packet;
+}
+
+std::unique_ptr<AudioStreamPacket> JitterBuffer::Get() {
+    int64_t now = esp_timer_get_time() / 1000;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffered_ == 0) {
+        if (playing_) {
+            // Only an underrun if the stream goes on, see Put()
+            playing_ = false;
+            ran_dry_ms_ = now;
+        }
+        return nullptr;
+    }
+
+    if (!playing_) {
+        // Prebuffer up to the target delay, or until the first packet has waited that long
+        uint32_t target_delay = TargetDelayMs();
+        if (buffered_ * frame_duration_ < target_delay && now - first_buffered_ms_ < target_delay) {
+            return nullptr;
+        }
+        playing_ = true;
+        last_output_ms_ = now;
+        // Skip the gap in front of the first packet we have
+        while (!SlotOf(next_sequence_)) {
+            next_sequence_++;
+        }
+        return TakeNext();
+    }
+
+    // The next packet is missing, wait for it until its playout deadline
+    if (!SlotOf(next_sequence_) && now - last_output_ms_ < frame_duration_) {
+        return nullptr;
+    }
+    last_output_ms_ = now;
+    return TakeNext();
+}
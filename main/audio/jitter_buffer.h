@@ -0,0 +1,78 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MIN_DELAY_MS 60
+#define JITTER_BUFFER_MAX_DELAY_MS 600
+
+struct JitterBufferStatistics {
+    uint32_t received_count = 0;
+    uint32_t late_count = 0;        // Arrived after its slot was played or concealed
+    uint32_t concealed_count = 0;   // Missing at its playout deadline, replaced by Opus PLC
+    uint32_t underrun_count = 0;    // Ran dry while playing and the stream went on
+    uint32_t jitter_ms = 0;         // Smoothed inter-arrival jitter
+    uint32_t target_delay_ms = 0;
+};
+
+/*
+ * Reorders downlink Opus packets by sequence number before they reach the decoder.
+ *
+ * Packets are held until the buffered audio reaches a target delay that follows the
+ * measured inter-arrival jitter (RFC 3550 estimator). A packet that is still missing
+ * when its playout deadline passes is handed out as an empty packet, which the Opus
+ * decoder turns into packet loss concealment.
+ *
+ * Sequence numbers are compared with serial number arithmetic, so the stream may wrap
+ * around 2^32. A packet far behind the window means the server restarted its sequence,
+ * and the buffer starts over from it.
+ *
+ * Put() is called from the network task and Get() from the decoder task.
+ */
+class JitterBuffer {
+public:
+    explicit JitterBuffer(size_t capacity);
+
+    void Put(std::unique_ptr<AudioStreamPacket> packet);
+    // Returns the next packet in sequence, an empty-payload packet for a lost one,
+    // or nullptr if nothing should be played yet
+    std::unique_ptr<AudioStreamPacket> Get();
+    void Reset();
+
+    bool empty();
+    JitterBufferStatistics statistics();
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> slots_;
+    size_t buffered_ = 0;
+    bool started_ = false;
+    bool playing_ = false;
+    uint32_t next_sequence_ = 0;
+    // Slots are indexed relative to the first sequence of the stream, which keeps the
+    // mapping continuous when the sequence wraps
+    uint32_t origin_sequence_ = 0;
+    uint32_t last_sequence_ = 0;
+    int64_t last_arrival_ms_ = 0;
+    int64_t first_buffered_ms_ = 0;
+    int64_t last_output_ms_ = 0;
+    // When playback last ran out of packets, 0 once the next packet has arrived
+    int64_t ran_dry_ms_ = 0;
+    int sample_rate_ = 0;
+    int frame_duration_ = 0;
+    // Jitter in 1/16 ms to keep precision in the integer estimator
+    uint32_t jitter_q4_ = 0;
+    JitterBufferStatistics statistics_;
+
+    uint32_t TargetDelayMs() const;
+    std::unique_ptr<AudioStreamPacket>& SlotOf(uint32_t sequence);
+    void ReleaseAll();
+    void Restart(uint32_t sequence);
+    std::unique_ptr<AudioStreamPacket> TakeNext();
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,242 @@
+#include "ogg_demuxer.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "OggDemuxer"
+
+// Ogg uses CRC-32 with polynomial 0x04c11db7, no reflection, initial value 0
+struct OggCrcTable {
+    uint32_t entries[256];
+
+    OggCrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i << 24;
+            for (int j = 0; j < 8; j++) {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+static uint32_t UpdateCrc(uint32_t crc, const uint8_t* data, size_t size) {
+    static const OggCrcTable table;
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ table.entries[((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+static inline uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+void OggPageReader::Reset(std::string_view data) {
+    data_ = data;
+    offset_ = 0;
+    crc_errors_ = 0;
+}
+
+size_t OggPageReader::FindCapturePattern(size_t start) const {
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(data_.data());
+    size_t size = data_.size();
+    while (start + 4 <= size) {
+        auto p = static_cast<const uint8_t*>(memchr(buf + start, 'O', size - start - 3));
+        if (p == nullptr) {
+            break;
+        }
+        if (memcmp(p, "OggS", 4) == 0) {
+            return p - buf;
+        }
+        start = p - buf + 1;
+    }
+    return std::string_view::npos;
+}
+
+bool OggPageReader::Next(OggPage& page) {
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(data_.data());
+    size_t size = data_.size();
+
+    while (true) {
+        size_t pos = FindCapturePattern(offset_);
+        if (pos == std::string_view::npos || pos + OGG_PAGE_HEADER_SIZE > size) {
+            offset_ = size;
+            return false;
+        }
+
+        const uint8_t* header = buf + pos;
+        uint8_t segment_count = header[26];
+        size_t body_offset = pos + OGG_PAGE_HEADER_SIZE + segment_count;
+        if (body_offset > size) {
+            offset_ = size;
+            return false;
+        }
+        size_t body_size = 0;
+        for (uint8_t i = 0; i < segment_count; i++) {
+            body_size += header[OGG_PAGE_HEADER_SIZE + i];
+        }
+        if (body_offset + body_size > size) {
+            // Truncated page, or a false capture pattern inside a body
+            offset_ = pos + 1;
+            continue;
+        }
+
+        // The CRC is computed with its own field set to zero
+        static const uint8_t zero_crc[4] = {0, 0, 0, 0};
+        uint32_t crc = UpdateCrc(0, header, 22);
+        crc = UpdateCrc(crc, zero_crc, 4);
+        crc = UpdateCrc(crc, header + 26, body_offset + body_size - pos - 26);
+        if (crc != ReadLe32(header + 22)) {
+            crc_errors_++;
+            ESP_LOGW(TAG, "CRC mismatch in page at offset %u", (unsigned)pos);
+            offset_ = pos + 1;
+            continue;
+        }
+
+        page.header_type = header[5];
+        page.granule_position = uint64_t(ReadLe32(header + 6)) | (uint64_t(ReadLe32(header + 10)) << 32);
+        page.serial_number = ReadLe32(header + 14);
+        page.sequence_number = ReadLe32(header + 18);
+        page.segment_table = header + OGG_PAGE_HEADER_SIZE;
+        page.segment_count = segment_count;
+        page.body = buf + body_offset;
+        page.body_size = body_size;
+        offset_ = body_offset + body_size;
+        return true;
+    }
+}
+
+void OggOpusReader::Open(std::string_view data) {
+    pages_.Reset(data);
+    page_ = OggPage();
+    has_page_ = false;
+    segment_index_ = 0;
+    body_offset_ = 0;
+    seen_head_ = false;
+    seen_tags_ = false;
+    sample_rate_ = 16000;
+    channels_ = 1;
+    pre_skip_ = 0;
+    continued_.clear();
+    continuing_ = false;
+    continued_overflow_ = false;
+}
+
+uint32_t OggOpusReader::position_ms() const {
+    if (page_.granule_position <= pre_skip_ || page_.granule_position == UINT64_MAX) {
+        return 0;
+    }
+    return (page_.granule_position - pre_skip_) / 48;
+}
+
+void OggOpusReader::AppendContinued(size_t start, size_t end) {
+    if (continued_overflow_) {
+        return;
+    }
+    if (continued_.size() + end - start > OGG_MAX_CONTINUED_PACKET_SIZE) {
+        ESP_LOGW(TAG, "Dropping a packet of more than %d bytes", OGG_MAX_CONTINUED_PACKET_SIZE);
+        continued_overflow_ = true;
+        continued_.clear();
+        return;
+    }
+    continued_.insert(continued_.end(), page_.body + start, page_.body + end);
+}
+
+bool OggOpusReader::NextRawPacket(std::string_view& packet) {
+    while (true) {
+        if (!has_page_ || segment_index_ >= page_.segment_count) {
+            uint32_t last_sequence = page_.sequence_number;
+            uint32_t last_serial = page_.serial_number;
+            bool had_page = has_page_;
+            if (!pages_.Next(page_)) {
+                has_page_ = false;
+                return false;
+            }
+            has_page_ = true;
+            segment_index_ = 0;
+            body_offset_ = 0;
+
+            bool continued = page_.header_type & OGG_HEADER_TYPE_CONTINUED;
+            bool follows = had_page && page_.serial_number == last_serial && page_.sequence_number == last_sequence + 1;
+            if (continuing_ && !(continued && follows)) {
+                // The page carrying the rest of the packet was lost (e.g. a CRC error)
+                ESP_LOGW(TAG, "Dropping a packet cut off at page %u", (unsigned)last_sequence);
+                continuing_ = false;
+            }
+            if (continued && !continuing_) {
+                // The tail of a packet whose head we do not have, skip it
+                uint8_t lacing;
+                do {
+                    lacing = page_.segment_table[segment_index_++];
+                    body_offset_ += lacing;
+                } while (lacing == 255 && segment_index_ < page_.segment_count);
+                continue;
+            }
+            if (page_.segment_count == 0) {
+                continue;
+            }
+        }
+
+        size_t start = body_offset_;
+        uint8_t lacing;
+        do {
+            lacing = page_.segment_table[segment_index_++];
+            body_offset_ += lacing;
+        } while (lacing == 255 && segment_index_ < page_.segment_count);
+
+        if (lacing == 255) {
+            // Lacing 255 on the last segment: the packet goes on in the next page
+            if (!continuing_) {
+                continued_.clear();
+                continued_overflow_ = false;
+                continuing_ = true;
+            }
+            AppendContinued(start, body_offset_);
+            continue;
+        }
+        if (continuing_) {
+            continuing_ = false;
+            AppendContinued(start, body_offset_);
+            if (continued_overflow_ || continued_.empty()) {
+                continue;
+            }
+            packet = std::string_view(reinterpret_cast<const char*>(continued_.data()), continued_.size());
+            return true;
+        }
+        if (body_offset_ == start) {
+            continue;
+        }
+        packet = std::string_view(reinterpret_cast<const char*>(page_.body + start), body_offset_ - start);
+        return true;
+    }
+}
+
+bool OggOpusReader::NextPacket(std::string_view& packet) {
+    while (NextRawPacket(packet)) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(packet.data());
+        if (!seen_head_) {
+            // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
+            // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
+            if (packet.size() >= 19 && memcmp(p, "OpusHead", 8) == 0) {
+                seen_head_ = true;
+                channels_ = p[9];
+                pre_skip_ = p[10] | (p[11] << 8);
+                if (ReadLe32(p + 12) != 0) {
+                    sample_rate_ = ReadLe32(p + 12);
+                }
+                ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", p[8], channels_, sample_rate_);
+            }
+            continue;
+        }
+        if (!seen_tags_) {
+            // Expect OpusTags in second packet
+            if (packet.size() >= 8 && memcmp(p, "OpusTags", 8) == 0) {
+                seen_tags_ = true;
+            }
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
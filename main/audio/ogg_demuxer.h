@@ -0,0 +1,89 @@
+#ifndef OGG_DEMUXER_H
+#define OGG_DEMUXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+// Packets spanning pages are assembled up to this size, larger ones (e.g. cover art in OpusTags) are dropped
+#define OGG_MAX_CONTINUED_PACKET_SIZE 65536
+
+// A view of one page inside the source buffer, nothing is copied
+struct OggPage {
+    uint8_t header_type = 0;
+    uint64_t granule_position = 0;
+    uint32_t serial_number = 0;
+    uint32_t sequence_number = 0;
+    const uint8_t* segment_table = nullptr;
+    uint8_t segment_count = 0;
+    const uint8_t* body = nullptr;
+    size_t body_size = 0;
+};
+
+/*
+ * Walks the pages of an Ogg stream held in memory (e.g. an asset mapped from flash).
+ * Every page is checked against its CRC. On a bad page the reader skips to the next
+ * capture pattern, so one corrupt page does not end the stream.
+ */
+class OggPageReader {
+public:
+    OggPageReader() = default;
+    explicit OggPageReader(std::string_view data) : data_(data) {}
+
+    void Reset(std::string_view data);
+    bool Next(OggPage& page);
+
+    uint32_t crc_errors() const { return crc_errors_; }
+
+private:
+    std::string_view data_;
+    size_t offset_ = 0;
+    uint32_t crc_errors_ = 0;
+
+    size_t FindCapturePattern(size_t start) const;
+};
+
+/*
+ * Hands out the audio packets of an Ogg Opus stream as views into the source buffer.
+ * OpusHead and OpusTags are consumed on the way. A packet that spans a page boundary
+ * is not contiguous in memory, so its pieces are assembled in a reused buffer and the
+ * view points there instead. Either way it is only valid until the next call.
+ */
+class OggOpusReader {
+public:
+    void Open(std::string_view data);
+    void Close() { Open(std::string_view()); }
+    bool NextPacket(std::string_view& packet);
+
+    // Input sample rate from OpusHead, 16000 if the stream has none
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+    // Granule position (48kHz samples, pre-skip included) at the end of the current page
+    uint64_t granule_position() const { return page_.granule_position; }
+    // Playback position at the end of the current page, in milliseconds
+    uint32_t position_ms() const;
+
+private:
+    OggPageReader pages_;
+    OggPage page_;
+    bool has_page_ = false;
+    uint8_t segment_index_ = 0;
+    size_t body_offset_ = 0;
+    bool seen_head_ = false;
+    bool seen_tags_ = false;
+    int sample_rate_ = 16000;
+    int channels_ = 1;
+    uint16_t pre_skip_ = 0;
+    // The head of a packet continued on the next page
+    std::vector<uint8_t> continued_;
+    bool continuing_ = false;
+    bool continued_overflow_ = false;
+
+    void AppendContinued(size_t start, size_t end);
+    bool NextRawPacket(std::string_view& packet);
+};
+
+#endif // OGG_DEMUXER_H
@@ -0,0 +1,85 @@
+#include "opus_uplink_encoder.h"
+
+#include <esp_log.h>
+#include <opus.h>
+
+#define TAG "OpusUplinkEncoder"
+
+// Same limit as AUDIO_PACKET_MAX_PAYLOAD_SIZE, a 60ms voice frame is far below it
+#define OPUS_UPLINK_MAX_PACKET_SIZE 1000
+
+OpusUplinkEncoder::OpusUplinkEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    frame_size_ = sample_rate_ * duration_ms_ / 1000;
+
+    int error;
+    encoder_ = opus_encoder_create(sample_rate_, channels_, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    opus_encoder_ctl(encoder_, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+}
+
+OpusUplinkEncoder::~OpusUplinkEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusUplinkEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusUplinkEncoder::SetDtx(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void OpusUplinkEncoder::SetBitrate(int bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate > 0 ? bitrate : OPUS_AUTO));
+    }
+}
+
+void OpusUplinkEncoder::SetInbandFec(bool enable, int expected_loss_percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(enable ? 1 : 0));
+        opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(enable ? expected_loss_percent : 0));
+    }
+}
+
+bool OpusUplinkEncoder::Encode(const std::vector<int16_t>& pcm, std::vector<uint8_t>& opus, size_t headroom) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr) {
+        return false;
+    }
+    if (pcm.size() != size_t(frame_size_ * channels_)) {
+        ESP_LOGE(TAG, "Unexpected frame size: %u, expected %d", pcm.size(), frame_size_ * channels_);
+        return false;
+    }
+
+    opus.resize(headroom + OPUS_UPLINK_MAX_PACKET_SIZE);
+    auto ret = opus_encode(encoder_, pcm.data(), frame_size_, opus.data() + headroom, OPUS_UPLINK_MAX_PACKET_SIZE);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        opus.clear();
+        return false;
+    }
+    opus.resize(headroom + ret);
+    return true;
+}
+
+void OpusUplinkEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+}
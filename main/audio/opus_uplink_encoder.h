@@ -0,0 +1,48 @@
+#ifndef OPUS_UPLINK_ENCODER_H
+#define OPUS_UPLINK_ENCODER_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct OpusEncoder;
+
+#define OPUS_DTX_PACKET_MAX_SIZE 2
+
+/*
+ * The uplink Opus encoder. It works like OpusEncoderWrapper, one frame of PCM in and
+ * one packet out, but also exposes the bitrate and in-band FEC controls that the
+ * uplink rate controller adjusts while a session is running.
+ */
+class OpusUplinkEncoder {
+public:
+    OpusUplinkEncoder(int sample_rate, int channels, int duration_ms);
+    ~OpusUplinkEncoder();
+
+    OpusUplinkEncoder(const OpusUplinkEncoder&) = delete;
+    OpusUplinkEncoder& operator=(const OpusUplinkEncoder&) = delete;
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    void SetComplexity(int complexity);
+    // With DTX on, silence is coded as packets of OPUS_DTX_PACKET_MAX_SIZE bytes or less,
+    // with a comfort noise update every 400ms
+    void SetDtx(bool enable);
+    void SetBitrate(int bitrate);
+    // expected_loss_percent tells the encoder how much redundancy to spend on FEC
+    void SetInbandFec(bool enable, int expected_loss_percent);
+    // pcm must hold exactly one frame, the packet is written into opus from offset headroom
+    bool Encode(const std::vector<int16_t>& pcm, std::vector<uint8_t>& opus, size_t headroom = 0);
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+};
+
+#endif // OPUS_UPLINK_ENCODER_H
@@ -0,0 +1,72 @@
+#include "sound_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "SoundCache"
+
+#if CONFIG_SPIRAM
+#define SOUND_CACHE_MALLOC_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define SOUND_CACHE_MALLOC_CAPS (MALLOC_CAP_DEFAULT)
+#endif
+
+SoundCacheEntry::~SoundCacheEntry() {
+    if (pcm != nullptr) {
+        heap_caps_free(pcm);
+    }
+}
+
+std::shared_ptr<const SoundCacheEntry> SoundCache::Find(std::string_view sound, int sample_rate) {
+    if (!enabled()) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        auto& entry = *it;
+        if (entry->data == sound.data() && entry->size == sound.size() && entry->sample_rate == sample_rate) {
+            entries_.splice(entries_.begin(), entries_, it);
+            hits_++;
+            return entries_.front();
+        }
+    }
+    misses_++;
+    return nullptr;
+}
+
+void SoundCache::Insert(std::string_view sound, int sample_rate, const std::vector<int16_t>& pcm) {
+    size_t bytes = pcm.size() * sizeof(int16_t);
+    if (!enabled() || bytes == 0 || bytes > max_entry_bytes()) {
+        return;
+    }
+
+    auto entry = std::make_shared<SoundCacheEntry>(sound.data(), sound.size(), sample_rate);
+    entry->pcm = static_cast<int16_t*>(heap_caps_malloc(bytes, SOUND_CACHE_MALLOC_CAPS));
+    if (entry->pcm == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %u bytes", (unsigned)bytes);
+        return;
+    }
+    memcpy(entry->pcm, pcm.data(), bytes);
+    entry->samples = pcm.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& existing : entries_) {
+        if (existing->data == sound.data() && existing->size == sound.size() && existing->sample_rate == sample_rate) {
+            return;
+        }
+    }
+    while (!entries_.empty() && used_bytes_ + bytes > budget_bytes_) {
+        used_bytes_ -= entries_.back()->bytes();
+        entries_.pop_back();
+    }
+    used_bytes_ += bytes;
+    entries_.push_front(std::move(entry));
+    ESP_LOGI(TAG, "Cached %u bytes of PCM, %u/%u bytes used", (unsigned)bytes, (unsigned)used_bytes_, (unsigned)budget_bytes_);
+}
+
+void SoundCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    used_bytes_ = 0;
+}
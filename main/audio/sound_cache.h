@@ -0,0 +1,61 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// Decoded PCM of one sound asset at one output sample rate
+struct SoundCacheEntry {
+    const char* data;   // The asset, used as the key
+    size_t size;
+    int sample_rate;
+    int16_t* pcm = nullptr;
+    size_t samples = 0;
+
+    SoundCacheEntry(const char* data, size_t size, int sample_rate) : data(data), size(size), sample_rate(sample_rate) {}
+    ~SoundCacheEntry();
+    SoundCacheEntry(const SoundCacheEntry&) = delete;
+    SoundCacheEntry& operator=(const SoundCacheEntry&) = delete;
+
+    size_t bytes() const { return samples * sizeof(int16_t); }
+};
+
+/*
+ * An LRU cache of decoded, output-rate PCM for short sounds such as UI prompts.
+ *
+ * Entries are keyed by the asset address and the output sample rate, so they only
+ * work for assets that never move (embedded in flash). The PCM lives in PSRAM when
+ * it is available. Entries are shared, so evicting one that is still playing is safe.
+ */
+class SoundCache {
+public:
+    explicit SoundCache(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+    bool enabled() const { return budget_bytes_ > 0; }
+    // Larger sounds are not cached, so one long prompt cannot flush all the short ones
+    size_t max_entry_bytes() const { return budget_bytes_ / 2; }
+
+    std::shared_ptr<const SoundCacheEntry> Find(std::string_view sound, int sample_rate);
+    void Insert(std::string_view sound, int sample_rate, const std::vector<int16_t>& pcm);
+    void Clear();
+
+    size_t used_bytes() const { return used_bytes_; }
+    uint32_t hits() const { return hits_; }
+    uint32_t misses() const { return misses_; }
+
+private:
+    std::mutex mutex_;
+    // Most recently used first
+    std::list<std::shared_ptr<SoundCacheEntry>> entries_;
+    size_t budget_bytes_;
+    size_t used_bytes_ = 0;
+    uint32_t hits_ = 0;
+    uint32_t misses_ = 0;
+};
+
+#endif // SOUND_CACHE_H
@@ -0,0 +1,121 @@
+#include "uplink_rate_controller.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "UplinkRate"
+
+UplinkRateController::UplinkRateController(int min_bitrate, int max_bitrate)
+    : min_bitrate_(min_bitrate), max_bitrate_(max_bitrate) {
+    target_.bitrate = max_bitrate_;
+}
+
+void UplinkRateController::SetBounds(int min_bitrate, int max_bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (min_bitrate <= 0 || max_bitrate < min_bitrate) {
+        ESP_LOGW(TAG, "Invalid bitrate range %d - %d", min_bitrate, max_bitrate);
+        return;
+    }
+    min_bitrate_ = min_bitrate;
+    max_bitrate_ = max_bitrate;
+    target_.bitrate = std::clamp(target_.bitrate, min_bitrate_, max_bitrate_);
+}
+
+void UplinkRateController::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    target_ = UplinkRateTarget();
+    target_.bitrate = max_bitrate_;
+    link_reported_ = false;
+    uplink_loss_reported_ = false;
+    rtt_ms_ = 0;
+    downlink_loss_q4_ = 0;
+    uplink_loss_q4_ = 0;
+    last_change_ms_ = 0;
+    clear_since_ms_ = -1;
+}
+
+// Truncating, so a clean link brings a loss back to exactly zero
+static uint32_t SmoothLoss(uint32_t loss_q4, uint32_t loss_percent) {
+    return (3 * loss_q4 + std::min<uint32_t>(loss_percent, 100) * 16) / 4;
+}
+
+void UplinkRateController::OnLinkReport(uint32_t rtt_ms, uint32_t downlink_loss_percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!link_reported_) {
+        link_reported_ = true;
+        rtt_ms_ = rtt_ms;
+        downlink_loss_q4_ = std::min<uint32_t>(downlink_loss_percent, 100) * 16;
+    } else {
+        rtt_ms_ = (3 * rtt_ms_ + rtt_ms) / 4;
+        downlink_loss_q4_ = SmoothLoss(downlink_loss_q4_, downlink_loss_percent);
+    }
+}
+
+void UplinkRateController::OnUplinkLoss(uint32_t loss_percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!uplink_loss_reported_) {
+        uplink_loss_reported_ = true;
+        uplink_loss_q4_ = std::min<uint32_t>(loss_percent, 100) * 16;
+    } else {
+        uplink_loss_q4_ = SmoothLoss(uplink_loss_q4_, loss_percent);
+    }
+}
+
+UplinkRateTarget UplinkRateController::target() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return target_;
+}
+
+uint32_t UplinkRateController::uplink_loss_percent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return uplink_loss_q4_ / 16;
+}
+
+uint32_t UplinkRateController::downlink_loss_percent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return downlink_loss_q4_ / 16;
+}
+
+bool UplinkRateController::OnFrameQueued(size_t queue_depth, size_t queue_capacity, int64_t now_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto previous = target_;
+    uint32_t uplink_loss = uplink_loss_q4_ / 16;
+    uint32_t downlink_loss = downlink_loss_q4_ / 16;
+    uint32_t loss = std::max(uplink_loss, downlink_loss);
+
+    bool congested = queue_depth * UPLINK_QUEUE_CONGESTED_DIVISOR >= queue_capacity ||
+        rtt_ms_ >= UPLINK_RTT_CONGESTED_MS || loss >= UPLINK_LOSS_CONGESTED_PERCENT;
+    // One frame waiting for the transport is the normal steady state
+    bool clear = queue_depth <= 1 && rtt_ms_ < UPLINK_RTT_CONGESTED_MS / 2 &&
+        loss < UPLINK_LOSS_FEC_PERCENT;
+
+    if (congested) {
+        clear_since_ms_ = -1;
+        if (now_ms - last_change_ms_ >= UPLINK_DECREASE_HOLD_MS && target_.bitrate > min_bitrate_) {
+            target_.bitrate = std::max(min_bitrate_, target_.bitrate * 3 / 4);
+            last_change_ms_ = now_ms;
+        }
+    } else if (clear) {
+        if (clear_since_ms_ < 0) {
+            clear_since_ms_ = now_ms;
+        }
+        if (now_ms - std::max(clear_since_ms_, last_change_ms_) >= UPLINK_INCREASE_HOLD_MS &&
+            target_.bitrate < max_bitrate_) {
+            target_.bitrate = std::min(max_bitrate_, target_.bitrate + UPLINK_BITRATE_STEP);
+            last_change_ms_ = now_ms;
+        }
+    } else {
+        clear_since_ms_ = -1;
+    }
+
+    // Downlink loss is only a proxy for the uplink, it never switches FEC on by itself
+    target_.fec = uplink_loss >= UPLINK_LOSS_FEC_PERCENT;
+    target_.loss_percent = target_.fec ? std::min<int>(uplink_loss, UPLINK_LOSS_MAX_PERCENT) : 0;
+
+    if (target_ != previous) {
+        ESP_LOGI(TAG, "Uplink bitrate %d, FEC %s (queue %u/%u, rtt %lu ms, loss up %lu%% down %lu%%)",
+            target_.bitrate, target_.fec ? "on" : "off", queue_depth, queue_capacity, rtt_ms_, uplink_loss, downlink_loss);
+        return true;
+    }
+    return false;
+}
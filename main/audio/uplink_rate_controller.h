@@ -0,0 +1,82 @@
+#ifndef UPLINK_RATE_CONTROLLER_H
+#define UPLINK_RATE_CONTROLLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Send queue depth, as a share of its capacity, at which the link counts as congested
+#define UPLINK_QUEUE_CONGESTED_DIVISOR 4
+#define UPLINK_RTT_CONGESTED_MS 600
+#define UPLINK_LOSS_CONGESTED_PERCENT 10
+#define UPLINK_LOSS_FEC_PERCENT 2
+#define UPLINK_LOSS_MAX_PERCENT 30
+// Minimum time between two decreases, and the clear period before each increase
+#define UPLINK_DECREASE_HOLD_MS 500
+#define UPLINK_INCREASE_HOLD_MS 2000
+#define UPLINK_BITRATE_STEP 2000
+
+struct UplinkRateTarget {
+    int bitrate = 0;
+    bool fec = false;
+    int loss_percent = 0;
+
+    bool operator==(const UplinkRateTarget& other) const {
+        return bitrate == other.bitrate && fec == other.fec && loss_percent == other.loss_percent;
+    }
+    bool operator!=(const UplinkRateTarget& other) const { return !(*this == other); }
+};
+
+/*
+ * Picks the uplink Opus bitrate and FEC settings from what the device can observe
+ * about the link: how far the send queue has backed up, the round trip time, and
+ * packet loss.
+ *
+ * Bitrate follows AIMD within [min_bitrate, max_bitrate]: a congested link cuts it
+ * by a quarter, a clear one raises it by UPLINK_BITRATE_STEP, each with a hold time
+ * so one late frame does not make it oscillate.
+ *
+ * Two losses are tracked apart. Loss of the uplink itself can only be measured by the
+ * server; once it reaches UPLINK_LOSS_FEC_PERCENT in-band FEC is switched on. Loss the
+ * device sees on the downlink is only a proxy for the shared path: high downlink loss
+ * counts as congestion and keeps the bitrate from rising, but never turns on FEC.
+ *
+ * OnFrameQueued() is called by the encoder task, the reports from any task.
+ */
+class UplinkRateController {
+public:
+    UplinkRateController(int min_bitrate, int max_bitrate);
+
+    void SetBounds(int min_bitrate, int max_bitrate);
+    // Back to the highest bitrate with no link history, e.g. for a new session
+    void Reset();
+
+    // Returns true if the target changed and should be applied to the encoder
+    bool OnFrameQueued(size_t queue_depth, size_t queue_capacity, int64_t now_ms);
+    // Round trip time and the loss measured on the downlink, e.g. from UDP sequence gaps
+    void OnLinkReport(uint32_t rtt_ms, uint32_t downlink_loss_percent);
+    // Loss of the uplink packets, as reported back by the server
+    void OnUplinkLoss(uint32_t loss_percent);
+
+    UplinkRateTarget target();
+    // Smoothed losses, in percent
+    uint32_t uplink_loss_percent();
+    uint32_t downlink_loss_percent();
+
+private:
+    std::mutex mutex_;
+    int min_bitrate_;
+    int max_bitrate_;
+    UplinkRateTarget target_;
+    // Smoothed reports, 1/4 gain. Losses are kept in 1/16 percent so that they decay
+    // all the way to zero instead of sticking at the rounding step
+    bool link_reported_ = false;
+    bool uplink_loss_reported_ = false;
+    uint32_t rtt_ms_ = 0;
+    uint32_t downlink_loss_q4_ = 0;
+    uint32_t uplink_loss_q4_ = 0;
+    int64_t last_change_ms_ = 0;
+    int64_t clear_since_ms_ = -1;
+};
+
+#endif // UPLINK_RATE_CONTROLLER_H
@@ -14,6 +14,9 @@ public:
     virtual bool Initialize(AudioCodec* codec) = 0;
     virtual void Feed(const std::vector<int16_t>& data) = 0;
     virtual void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) = 0;
+    // Called when speech starts while detecting, before any wake word can be recognized.
+    // Engines without a VAD never call it
+    virtual void OnVoiceOnset(std::function<void()> callback) {}
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual size_t GetFeedSize() = 0;
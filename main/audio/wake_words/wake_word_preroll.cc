@@ -0,0 +1,159 @@
+#include "wake_word_preroll.h"
+#include "audio_service.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "WakeWordPreroll"
+
+WakeWordPreroll::WakeWordPreroll() {
+    frame_samples_ = 16000 * OPUS_FRAME_DURATION_MS / 1000;
+    size_t frames = WAKE_WORD_PREROLL_DURATION_MS / OPUS_FRAME_DURATION_MS;
+    pcm_.resize(frame_samples_ * frames);
+    frame_.resize(frame_samples_);
+    packets_.resize(frames);
+    for (auto& packet : packets_) {
+        packet.reserve(WAKE_WORD_PREROLL_OPUS_RESERVE);
+    }
+
+    encoder_ = std::make_unique<OpusUplinkEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+    encoder_->SetComplexity(0); // 0 is the fastest
+
+    // The Opus encoder needs a large stack, keep it in PSRAM
+    const size_t stack_size = 4096 * 7;
+    encode_task_stack_ = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
+    assert(encode_task_stack_ != nullptr);
+    encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+    assert(encode_task_buffer_ != nullptr);
+    encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (WakeWordPreroll*)arg;
+        this_->EncodeTask();
+    }, "encode_wake_word", stack_size, this, 2, encode_task_stack_, encode_task_buffer_);
+}
+
+WakeWordPreroll::~WakeWordPreroll() {
+    if (encode_task_ != nullptr) {
+        vTaskDelete(encode_task_);
+    }
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    if (encode_task_buffer_ != nullptr) {
+        heap_caps_free(encode_task_buffer_);
+    }
+}
+
+void WakeWordPreroll::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pcm_write_ = 0;
+    encode_read_ = encode_end_ = 0;
+    packet_head_ = packet_count_ = 0;
+    finishing_ = false;
+    finished_ = false;
+    generation_++;
+}
+
+void WakeWordPreroll::Feed(const int16_t* data, size_t samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finishing_) {
+        return;
+    }
+    size_t capacity = pcm_.size();
+    if (samples > capacity) {
+        data += samples - capacity;
+        pcm_write_ += samples - capacity;
+        samples = capacity;
+    }
+    // At most two copies, up to the end of the buffer and then from its start
+    size_t offset = pcm_write_ % capacity;
+    size_t first = std::min(samples, capacity - offset);
+    memcpy(pcm_.data() + offset, data, first * sizeof(int16_t));
+    memcpy(pcm_.data(), data + first, (samples - first) * sizeof(int16_t));
+    pcm_write_ += samples;
+}
+
+void WakeWordPreroll::Finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finishing_) {
+            return;
+        }
+        finishing_ = true;
+        // Take the most recent complete frames, Feed() leaves the buffer alone from now on
+        size_t stored = std::min(pcm_write_, pcm_.size());
+        encode_end_ = pcm_write_;
+        encode_read_ = pcm_write_ - stored / frame_samples_ * frame_samples_;
+    }
+    xTaskNotifyGive(encode_task_);
+}
+
+void WakeWordPreroll::EncodeTask() {
+    while (true) {
+        // Nothing is encoded until a wake word has been detected
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!finishing_ || finished_) {
+                continue;
+            }
+            generation = generation_;
+        }
+        encoder_->ResetState();
+
+        auto start_time = esp_timer_get_time();
+        while (true) {
+            size_t slot;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (generation != generation_) {
+                    break;
+                }
+                if (encode_read_ == encode_end_) {
+                    finished_ = true;
+                    ESP_LOGI(TAG, "Encode wake word opus %u packets in %ld ms", (unsigned)packet_count_,
+                        (long)((esp_timer_get_time() - start_time) / 1000));
+                    cv_.notify_all();
+                    break;
+                }
+                size_t capacity = pcm_.size();
+                size_t offset = encode_read_ % capacity;
+                size_t first = std::min(frame_samples_, capacity - offset);
+                memcpy(frame_.data(), pcm_.data() + offset, first * sizeof(int16_t));
+                memcpy(frame_.data() + first, pcm_.data(), (frame_samples_ - first) * sizeof(int16_t));
+                encode_read_ += frame_samples_;
+                // The ring holds every frame of the run, Pop() only reads the slots before this one
+                slot = (packet_head_ + packet_count_) % packets_.size();
+            }
+
+            // Encode outside the lock, so Pop() can hand out the previous packets meanwhile
+            bool encoded = encoder_->Encode(frame_, packets_[slot]);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (encoded && generation == generation_) {
+                packet_count_++;
+                cv_.notify_all();
+            }
+        }
+    }
+}
+
+bool WakeWordPreroll::Pop(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() {
+        return packet_count_ > 0 || finished_;
+    });
+    if (packet_count_ == 0) {
+        return false;
+    }
+    // Copy rather than swap, so the ring keeps its preallocated buffers
+    auto& packet = packets_[packet_head_];
+    opus.assign(packet.begin(), packet.end());
+    packet_head_ = (packet_head_ + 1) % packets_.size();
+    packet_count_--;
+    return true;
+}
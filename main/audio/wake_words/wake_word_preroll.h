@@ -0,0 +1,69 @@
+#ifndef WAKE_WORD_PREROLL_H
+#define WAKE_WORD_PREROLL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "opus_uplink_encoder.h"
+
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#define WAKE_WORD_PREROLL_DURATION_MS 2000
+#define WAKE_WORD_PREROLL_OPUS_RESERVE 256
+
+/*
+ * Keeps the audio leading up to a wake word.
+ *
+ * The detection task copies 16kHz mono samples into a preallocated circular PCM
+ * buffer holding the last WAKE_WORD_PREROLL_DURATION_MS, nothing else runs while
+ * waiting for a wake word. Finish() freezes the buffer and wakes a background task
+ * that encodes it frame by frame into a ring of reused packet buffers, and Pop()
+ * hands out each packet as soon as it is ready.
+ */
+class WakeWordPreroll {
+public:
+    WakeWordPreroll();
+    ~WakeWordPreroll();
+
+    // Drops the stored audio, called when detection (re)starts
+    void Reset();
+    // 16kHz mono samples from the detection task
+    void Feed(const int16_t* data, size_t samples);
+    // Stops accepting audio and starts encoding the complete frames stored so far
+    void Finish();
+    // Blocks until the next packet is encoded, returns false after the last packet
+    bool Pop(std::vector<uint8_t>& opus);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t* encode_task_buffer_ = nullptr;
+    StackType_t* encode_task_stack_ = nullptr;
+    std::unique_ptr<OpusUplinkEncoder> encoder_;
+
+    size_t frame_samples_;
+    std::vector<int16_t> pcm_;
+    // Total samples fed since Reset(), the buffer holds the last pcm_.size() of them
+    size_t pcm_write_ = 0;
+    // The frames Finish() left for the encode task, as positions in the fed samples
+    size_t encode_read_ = 0;
+    size_t encode_end_ = 0;
+    std::vector<int16_t> frame_;
+
+    std::vector<std::vector<uint8_t>> packets_;
+    size_t packet_head_ = 0;
+    size_t packet_count_ = 0;
+
+    bool finishing_ = false;
+    bool finished_ = false;
+    // Bumped by Reset(), so an encoding run across a reset is abandoned
+    uint32_t generation_ = 0;
+
+    void EncodeTask();
+};
+
+#endif // WAKE_WORD_PREROLL_H
@@ -35,7 +35,7 @@ private:
     Button volume_down_button_;
     Button user_button_; // 新增语音ASRPRO激活板virtual按键
     Button human_sensor_button_; // 新增人体接近传感器激活按键，利用Button类实现
-    TopdEmojiDisplay* display_;
+    TopdEmojiDisplay* display_ = nullptr;
     PowerSaveTimer* power_save_timer_;
     PowerManager* power_manager_;
     esp_lcd_panel_io_handle_t panel_io_ = nullptr;
@@ -48,10 +48,16 @@ private:
 
     void InitializePowerManager() {
         power_manager_ = new PowerManager(GPIO_NUM_9);
-        // power_manager_->OnTemperatureChanged([this](float chip_temp) {
-        //     display_->UpdateHighTempWarning(chip_temp);
-        // });
+        // 状态变化直接推送给状态栏，无需等待时钟轮询
+        power_manager_->OnTemperatureChanged([this](float chip_temp) {
+            if (display_ != nullptr) {
+                display_->PublishChipTemperature(chip_temp);
+            }
+        });
         power_manager_->OnChargingStatusChanged([this](bool is_charging) {
+            if (display_ != nullptr) {
+                display_->PublishBattery(std::max<uint32_t>(power_manager_->GetBatteryLevel(), 20), is_charging);
+            }
             if (is_charging) {
                 power_save_timer_->SetEnabled(false);
             } else {
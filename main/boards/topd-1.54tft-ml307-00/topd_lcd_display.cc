@@ -5,7 +5,6 @@
 #include <algorithm>
 #include <cstring>
 #include <string>
-#include <libs/gif/lv_gif.h>
 #include "board.h"
 #include "display/lcd_display.h"
 #include "font_awesome_symbols.h"
@@ -55,15 +54,16 @@ TopdEmojiDisplay::TopdEmojiDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_p
                                    int width, int height, int offset_x, int offset_y, bool mirror_x,
                                    bool mirror_y, bool swap_xy, DisplayFonts fonts)
     : SpiLcdDisplay(panel_io, panel, width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy,
-                    fonts),
-      emotion_gif_(nullptr) {
+                    fonts) {
     ESP_LOGI(TAG,"TopdDisplay construct");
    
     
     SwitchToGifContainer(); 
     ESP_LOGI(TAG,"SetupGifContainer();");
-    
-   
+
+    // 其余表情在后台逐个解码，首次切换时无需等待
+    DisplayLockGuard lock(this);
+    gif_cache_.Preload({&happy, &sad, &anger, &scare, &buxue});
 };
 
 void TopdEmojiDisplay::SwitchToGifContainer() {
@@ -83,6 +83,7 @@ void TopdEmojiDisplay::SwitchToGifContainer() {
     if (qr_image_object_) {
         lv_obj_del(qr_image_object_);
     }
+    emotion_player_.reset();
     
     content_ = lv_obj_create(container_);
     lv_obj_set_scrollbar_mode(content_, LV_SCROLLBAR_MODE_OFF);
@@ -98,13 +99,7 @@ void TopdEmojiDisplay::SwitchToGifContainer() {
     lv_obj_set_style_border_width(emotion_label_, 0, 0);
     lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
 
-    emotion_gif_ = lv_gif_create(content_);
-    int gif_size = LV_HOR_RES;
-    lv_obj_set_size(emotion_gif_, gif_size, gif_size);
-    lv_obj_set_style_border_width(emotion_gif_, 0, 0);
-    lv_obj_set_style_bg_opa(emotion_gif_, LV_OPA_TRANSP, 0);
-    lv_obj_center(emotion_gif_);
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    emotion_player_ = std::make_unique<GifPlayer>(content_);
 
     chat_message_label_ = lv_label_create(content_);
     lv_label_set_text(chat_message_label_, "");
@@ -121,6 +116,9 @@ void TopdEmojiDisplay::SwitchToGifContainer() {
     lv_obj_align(chat_message_label_, LV_ALIGN_BOTTOM_MID, 0, 0);
 
     LcdDisplay::SetTheme("dark");
+    // 透明像素按主题背景色预先混合
+    gif_cache_.SetBackground(current_theme_.background);
+    PlayGif(&staticstate);
 }
 
 void TopdEmojiDisplay::SwitchToActivationStatusContainer()
@@ -133,10 +131,7 @@ void TopdEmojiDisplay::SwitchToActivationStatusContainer()
         emotion_label_=nullptr;
     }
 
-    if (emotion_gif_) {
-        lv_obj_del(emotion_gif_);
-        emotion_gif_=nullptr;
-    }
+    emotion_player_.reset();
 
     if (chat_message_label_) {
         lv_obj_del(chat_message_label_);
@@ -165,7 +160,7 @@ void TopdEmojiDisplay::SwitchToActivationStatusContainer()
 }
 
 void TopdEmojiDisplay::SetEmotion(const char* emotion) {
-    if (!emotion || !emotion_gif_) {
+    if (!emotion || !emotion_player_) {
         return;
     }
 
@@ -173,16 +168,25 @@ void TopdEmojiDisplay::SetEmotion(const char* emotion) {
 
     for (const auto& map : emotion_maps_) {
         if (map.name && strcmp(map.name, emotion) == 0) {
-            lv_gif_set_src(emotion_gif_, map.gif);
+            PlayGif(map.gif);
             ESP_LOGI(TAG, "设置表情: %s", emotion);
             return;
         }
     }
 
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    PlayGif(&staticstate);
     ESP_LOGI(TAG, "未知表情'%s'，使用默认", emotion);
 }
 
+void TopdEmojiDisplay::PlayGif(const lv_img_dsc_t* gif) {
+    // 未缓存的表情在LVGL定时器中逐帧解码，解码完成前继续播放当前表情
+    gif_cache_.Request(gif, [this](const GifAnimation* animation) {
+        if (emotion_player_) {
+            emotion_player_->Play(animation);
+        }
+    });
+}
+
 void TopdEmojiDisplay::SetChatMessage(const char* role, const char* content) {
     DisplayLockGuard lock(this);
     if (chat_message_label_ == nullptr) {
@@ -1,9 +1,10 @@
 #ifndef TOPD_LCD_DISPLAY_H
 #define TOPD_LCD_DISPLAY_H
 
-#include <libs/gif/lv_gif.h>
+#include <memory>
 
 #include "display/lcd_display.h"
+#include "display/gif_frame_cache.h"
 //#include <esp_lvgl_port.h>
 #include "otto_emoji_gif.h"
 
@@ -86,7 +87,9 @@ public:
     //otto 新增函数
 private:
     
-    lv_obj_t* emotion_gif_;  ///< GIF表情组件 >
+    // 表情GIF只解码一次，缓存在PSRAM中，逐帧只刷新变化区域
+    GifFrameCache gif_cache_;
+    std::unique_ptr<GifPlayer> emotion_player_;
     lv_obj_t* qr_image_object_ = nullptr;
     // 表情映射
     struct EmotionMap {
@@ -95,6 +98,9 @@ private:
     };
 
     static const EmotionMap emotion_maps_[];
+
+    // 播放表情GIF，未解码的GIF在解码完成后才切换
+    void PlayGif(const lv_img_dsc_t* gif);
 };
 
 #endif // TOPD_LCD_DISPLAY_H
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 
 #include "display.h"
 #include "board.h"
@@ -14,6 +15,9 @@
 
 #define TAG "Display"
 
+// Status changes arriving within this window are drawn in a single update
+#define STATUS_BAR_COALESCE_MS 30
+
 Display::Display() {
     // Notification timer
     esp_timer_create_args_t notification_timer_args = {
@@ -30,6 +34,18 @@ Display::Display() {
     };
     ESP_ERROR_CHECK(esp_timer_create(&notification_timer_args, &notification_timer_));
 
+    // Status bar timer, started once per burst of status changes
+    esp_timer_create_args_t status_bar_timer_args = {
+        .callback = [](void *arg) {
+            static_cast<Display*>(arg)->ApplyStatusBar();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "status_bar_timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&status_bar_timer_args, &status_bar_timer_));
+
     // Create a power management lock
     auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "display_update", &pm_lock_);
     if (ret == ESP_ERR_NOT_SUPPORTED) {
@@ -44,6 +60,10 @@ Display::~Display() {
         esp_timer_stop(notification_timer_);
         esp_timer_delete(notification_timer_);
     }
+    if (status_bar_timer_ != nullptr) {
+        esp_timer_stop(status_bar_timer_);
+        esp_timer_delete(status_bar_timer_);
+    }
 
     if (network_label_ != nullptr) {
         lv_obj_del(network_label_);
@@ -94,70 +114,18 @@ void Display::ShowNotification(const char* notification, int duration_ms) {
 void Display::UpdateStatusBar(bool update_all) {
     auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
+    PublishMuted(codec->output_volume() == 0);
 
-    {
-        DisplayLockGuard lock(this);
-        if (mute_label_ == nullptr) {
-            return;
-        }
-
-        // 如果静音状态改变，则更新图标
-        if (codec->output_volume() == 0 && !muted_) {
-            muted_ = true;
-            lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_MUTE);
-        } else if (codec->output_volume() > 0 && muted_) {
-            muted_ = false;
-            lv_label_set_text(mute_label_, "");
-        }
-    }
-
-    esp_pm_lock_acquire(pm_lock_);
-    // 更新电池图标
     int battery_level;
     bool charging, discharging;
-    float chip_temp;
-    const char* icon = nullptr;
     if (board.GetBatteryLevel(battery_level, charging, discharging)) {
-        if (charging) {
-            icon = FONT_AWESOME_BATTERY_CHARGING;
-        } else {
-            const char* levels[] = {
-                FONT_AWESOME_BATTERY_EMPTY, // 0-19%
-                FONT_AWESOME_BATTERY_1,    // 20-39%
-                FONT_AWESOME_BATTERY_2,    // 40-59%
-                FONT_AWESOME_BATTERY_3,    // 60-79%
-                FONT_AWESOME_BATTERY_FULL, // 80-99%
-                FONT_AWESOME_BATTERY_FULL, // 100%
-            };
-            icon = levels[battery_level / 20];
-        }
-        DisplayLockGuard lock(this);
-        if (battery_label_ != nullptr && battery_icon_ != icon) {
-            battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
-        }
+        PublishBattery(battery_level, charging);
     }
 
-    if (board.GetESP32Temp(chip_temp)){
-        // 更新温度过高提示框
-        if (high_temp_popup_ != nullptr) {
-            if (chip_temp >= 65.0f) {
-                if (lv_obj_has_flag(high_temp_popup_, LV_OBJ_FLAG_HIDDEN)) {
-                    // 显示温度过高提示框
-                    lv_obj_clear_flag(high_temp_popup_, LV_OBJ_FLAG_HIDDEN);
-                    auto& app = Application::GetInstance();
-                    app.PlaySound(Lang::Sounds::P3_LOW_BATTERY);
-                }
-            } else {
-                // 隐藏温度过高提示框
-                if (!lv_obj_has_flag(high_temp_popup_, LV_OBJ_FLAG_HIDDEN)) {
-                    lv_obj_add_flag(high_temp_popup_, LV_OBJ_FLAG_HIDDEN);
-                }
-            }
-        } else {
-            ESP_LOGW("PowerManager", "high_temp_popup_ is null!");
-        }
-    } 
+    float chip_temp;
+    if (board.GetESP32Temp(chip_temp)) {
+        PublishChipTemperature(chip_temp);
+    }
 
     // 每 10 秒更新一次网络图标
     static int seconds_counter = 0;
@@ -172,16 +140,126 @@ void Display::UpdateStatusBar(bool update_all) {
             kDeviceStateActivating,
         };
         if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
-            icon = board.GetNetworkStateIcon();
-            if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
-                network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
-            }
+            PublishNetworkIcon(board.GetNetworkStateIcon());
         }
     }
 
+    // Callers asking for everything are about to refresh the screen, so draw now
+    if (update_all) {
+        ApplyStatusBar();
+    }
+}
+
+void Display::PublishMuted(bool muted) {
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    if (published_status_.muted == muted) {
+        return;
+    }
+    published_status_.muted = muted;
+    ScheduleStatusBarUpdate();
+}
+
+void Display::PublishBattery(int level, bool charging) {
+    const char* icon;
+    if (charging) {
+        icon = FONT_AWESOME_BATTERY_CHARGING;
+    } else {
+        const char* levels[] = {
+            FONT_AWESOME_BATTERY_EMPTY, // 0-19%
+            FONT_AWESOME_BATTERY_1,    // 20-39%
+            FONT_AWESOME_BATTERY_2,    // 40-59%
+            FONT_AWESOME_BATTERY_3,    // 60-79%
+            FONT_AWESOME_BATTERY_FULL, // 80-99%
+            FONT_AWESOME_BATTERY_FULL, // 100%
+        };
+        icon = levels[std::clamp(level, 0, 100) / 20];
+    }
+
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    if (published_status_.battery_icon == icon) {
+        return;
+    }
+    published_status_.battery_icon = icon;
+    ScheduleStatusBarUpdate();
+}
+
+void Display::PublishNetworkIcon(const char* icon) {
+    if (icon == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    if (published_status_.network_icon == icon) {
+        return;
+    }
+    published_status_.network_icon = icon;
+    ScheduleStatusBarUpdate();
+}
+
+void Display::PublishChipTemperature(float temperature) {
+    bool high_temp = temperature >= 65.0f;
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    if (published_status_.high_temp == high_temp) {
+        return;
+    }
+    published_status_.high_temp = high_temp;
+    ScheduleStatusBarUpdate();
+}
+
+// Called with status_mutex_ held
+void Display::ScheduleStatusBarUpdate() {
+    if (status_update_pending_ || status_bar_timer_ == nullptr) {
+        return;
+    }
+    status_update_pending_ = true;
+    esp_timer_start_once(status_bar_timer_, STATUS_BAR_COALESCE_MS * 1000);
+}
+
+void Display::ApplyStatusBar() {
+    StatusBarState status, previous;
+    uint32_t updates;
+
+    esp_pm_lock_acquire(pm_lock_);
+    {
+        // The snapshot is taken under the display lock too, so a direct UpdateStatusBar(true)
+        // and the coalescing timer cannot apply their snapshots to the labels out of order
+        DisplayLockGuard lock(this);
+        {
+            std::lock_guard<std::mutex> status_lock(status_mutex_);
+            status_update_pending_ = false;
+            status = published_status_;
+            previous = applied_status_;
+            if (status == previous) {
+                esp_pm_lock_release(pm_lock_);
+                return;
+            }
+            applied_status_ = status;
+            updates = ++status_bar_updates_;
+        }
+        // 如果静音状态改变，则更新图标
+        if (mute_label_ != nullptr && status.muted != previous.muted) {
+            lv_label_set_text(mute_label_, status.muted ? FONT_AWESOME_VOLUME_MUTE : "");
+        }
+        if (battery_label_ != nullptr && status.battery_icon != previous.battery_icon) {
+            lv_label_set_text(battery_label_, status.battery_icon);
+        }
+        if (network_label_ != nullptr && status.network_icon != previous.network_icon) {
+            lv_label_set_text(network_label_, status.network_icon);
+        }
+        // 更新温度过高提示框
+        if (high_temp_popup_ != nullptr && status.high_temp != previous.high_temp) {
+            if (status.high_temp) {
+                lv_obj_clear_flag(high_temp_popup_, LV_OBJ_FLAG_HIDDEN);
+            } else {
+                lv_obj_add_flag(high_temp_popup_, LV_OBJ_FLAG_HIDDEN);
+            }
+        }
+    }
     esp_pm_lock_release(pm_lock_);
+
+    if (high_temp_popup_ != nullptr && status.high_temp && !previous.high_temp) {
+        Application::GetInstance().PlaySound(Lang::Sounds::P3_LOW_BATTERY);
+    }
+    ESP_LOGD(TAG, "Status bar update #%lu", (unsigned long)updates);
 }
 
 
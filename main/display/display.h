@@ -7,6 +7,7 @@
 #include <esp_pm.h>
 
 #include <string>
+#include <mutex>
 
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
@@ -30,6 +31,12 @@ public:
     virtual void SetTheme(const std::string& theme_name);
     virtual std::string GetTheme() { return current_theme_name_; }
     virtual void UpdateStatusBar(bool update_all = false);
+    // Status sources publish their latest value, unchanged values return without taking any lock.
+    // Changes are coalesced and applied together in one locked update
+    void PublishMuted(bool muted);
+    void PublishBattery(int level, bool charging);
+    void PublishNetworkIcon(const char* icon);
+    void PublishChipTemperature(float temperature);
     virtual void SwitchToGifContainer() {}; //do nothing,for topd board use
     virtual void SwitchToActivationStatusContainer() {}; //do nothing,for topd board use
     inline int width() const { return width_; }
@@ -54,12 +61,32 @@ protected:
     lv_obj_t* high_temp_popup_ = nullptr;
     lv_obj_t* high_temp_label_ = nullptr;
     
-    const char* battery_icon_ = nullptr;
-    const char* network_icon_ = nullptr;
-    bool muted_ = false;
+    struct StatusBarState {
+        bool muted = false;
+        const char* battery_icon = nullptr;
+        const char* network_icon = nullptr;
+        bool high_temp = false;
+
+        bool operator==(const StatusBarState& other) const {
+            return muted == other.muted && battery_icon == other.battery_icon &&
+                network_icon == other.network_icon && high_temp == other.high_temp;
+        }
+    };
+
+    // Published and applied state are guarded by status_mutex_, the labels by the display lock.
+    // ApplyStatusBar takes status_mutex_ inside the display lock, never the other way round
+    std::mutex status_mutex_;
+    StatusBarState published_status_;
+    StatusBarState applied_status_;
+    bool status_update_pending_ = false;
+    uint32_t status_bar_updates_ = 0;
     std::string current_theme_name_;
 
     esp_timer_handle_t notification_timer_ = nullptr;
+    esp_timer_handle_t status_bar_timer_ = nullptr;
+
+    void ScheduleStatusBarUpdate();
+    void ApplyStatusBar();
 
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
@@ -0,0 +1,364 @@
+#include "gif_frame_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <libs/gif/gifdec.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "GifFrameCache"
+
+#if CONFIG_SPIRAM
+#define GIF_CACHE_MALLOC_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define GIF_CACHE_MALLOC_CAPS (MALLOC_CAP_DEFAULT)
+#endif
+
+static uint16_t ToRgb565(const lv_color32_t& pixel, lv_color_t background) {
+    uint8_t red = pixel.red;
+    uint8_t green = pixel.green;
+    uint8_t blue = pixel.blue;
+    if (pixel.alpha != 0xFF) {
+        red = (red * pixel.alpha + background.red * (0xFF - pixel.alpha)) / 0xFF;
+        green = (green * pixel.alpha + background.green * (0xFF - pixel.alpha)) / 0xFF;
+        blue = (blue * pixel.alpha + background.blue * (0xFF - pixel.alpha)) / 0xFF;
+    }
+    return ((red & 0xF8) << 8) | ((green & 0xFC) << 3) | (blue >> 3);
+}
+
+GifAnimation::~GifAnimation() {
+    heap_caps_free(keyframe_);
+    for (auto& frame : frames_) {
+        heap_caps_free(frame.pixels);
+    }
+}
+
+bool GifAnimation::SetDelta(const uint16_t* from, const uint16_t* to, Frame& frame) {
+    int left = width_, top = height_, right = -1, bottom = -1;
+    for (int y = 0; y < height_; y++) {
+        const uint16_t* a = from + y * width_;
+        const uint16_t* b = to + y * width_;
+        for (int x = 0; x < width_; x++) {
+            if (a[x] != b[x]) {
+                left = std::min(left, x);
+                right = std::max(right, x);
+                top = std::min(top, y);
+                bottom = y;
+            }
+        }
+    }
+    if (right < 0) {
+        return true;
+    }
+
+    frame.x = left;
+    frame.y = top;
+    frame.width = right - left + 1;
+    frame.height = bottom - top + 1;
+    size_t size = frame.width * frame.height * sizeof(uint16_t);
+    frame.pixels = (uint16_t*)heap_caps_malloc(size, GIF_CACHE_MALLOC_CAPS);
+    if (frame.pixels == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for a frame", (unsigned)size);
+        return false;
+    }
+    for (int y = 0; y < frame.height; y++) {
+        memcpy(frame.pixels + y * frame.width, to + (frame.y + y) * width_ + frame.x, frame.width * sizeof(uint16_t));
+    }
+    bytes_ += size;
+    return true;
+}
+
+/*
+ * The state of one GIF being decoded: the gifdec handle, the render buffers and the
+ * animation built so far. Step() advances it a few frames at a time.
+ */
+struct GifDecodeJob {
+    const lv_img_dsc_t* gif;
+    lv_color_t background;
+    gd_GIF* decoder = nullptr;
+    lv_color32_t* rendered = nullptr;
+    uint16_t* previous = nullptr;
+    uint16_t* current = nullptr;
+    std::unique_ptr<GifAnimation> animation;
+    bool ok = false;
+    int64_t decode_us = 0;
+
+    GifDecodeJob(const lv_img_dsc_t* gif, lv_color_t background) : gif(gif), background(background) {
+        decoder = gd_open_gif_data(gif->data);
+        if (decoder == nullptr) {
+            ESP_LOGE(TAG, "Failed to open GIF");
+            return;
+        }
+
+        animation.reset(new GifAnimation(decoder->width, decoder->height));
+        size_t pixels = decoder->width * decoder->height;
+        // gifdec renders the whole composed frame as ARGB8888, the other buffers hold it as RGB565
+        rendered = (lv_color32_t*)heap_caps_malloc(pixels * sizeof(lv_color32_t), GIF_CACHE_MALLOC_CAPS);
+        previous = (uint16_t*)heap_caps_malloc(pixels * sizeof(uint16_t), GIF_CACHE_MALLOC_CAPS);
+        current = (uint16_t*)heap_caps_malloc(pixels * sizeof(uint16_t), GIF_CACHE_MALLOC_CAPS);
+        animation->keyframe_ = (uint16_t*)heap_caps_malloc(pixels * sizeof(uint16_t), GIF_CACHE_MALLOC_CAPS);
+        ok = rendered != nullptr && previous != nullptr && current != nullptr && animation->keyframe_ != nullptr;
+        if (!ok) {
+            ESP_LOGE(TAG, "Failed to allocate buffers for a %ux%u GIF", decoder->width, decoder->height);
+        }
+        animation->bytes_ = pixels * sizeof(uint16_t);
+    }
+
+    ~GifDecodeJob() {
+        heap_caps_free(rendered);
+        heap_caps_free(previous);
+        heap_caps_free(current);
+        if (decoder != nullptr) {
+            gd_close_gif(decoder);
+        }
+    }
+
+    // Decodes up to max_frames more frames, returns false once the GIF is finished or failed
+    bool Step(int max_frames) {
+        int64_t start_time = esp_timer_get_time();
+        bool more = ok;
+        for (int i = 0; more && i < max_frames; i++) {
+            more = DecodeFrame();
+        }
+        decode_us += esp_timer_get_time() - start_time;
+        return more;
+    }
+
+    // The complete animation, nullptr if the GIF is invalid or memory ran out
+    std::unique_ptr<GifAnimation> Take() {
+        if (!ok || animation == nullptr || animation->frames_.empty()) {
+            return nullptr;
+        }
+        ESP_LOGI(TAG, "Decoded %ux%u GIF with %u frames into %u bytes in %ld ms", animation->width_, animation->height_,
+            (unsigned)animation->frames_.size(), (unsigned)animation->bytes_, (long)(decode_us / 1000));
+        return std::move(animation);
+    }
+
+private:
+    bool DecodeFrame() {
+        size_t pixels = animation->width_ * animation->height_;
+        if (gd_get_frame(decoder) != 1) {
+            // Frame 0 gets the change from the last frame back to the first
+            if (animation->frames_.size() > 1) {
+                ok = animation->SetDelta(previous, animation->keyframe_, animation->frames_[0]);
+            }
+            return false;
+        }
+        gd_render_frame(decoder, (uint8_t*)rendered);
+        for (size_t i = 0; i < pixels; i++) {
+            current[i] = ToRgb565(rendered[i], background);
+        }
+
+        GifAnimation::Frame frame;
+        frame.delay_ms = std::max<int>(decoder->gce.delay * 10, GIF_MIN_FRAME_DELAY_MS);
+        if (animation->frames_.empty()) {
+            memcpy(animation->keyframe_, current, pixels * sizeof(uint16_t));
+        } else {
+            ok = animation->SetDelta(previous, current, frame);
+        }
+        animation->frames_.push_back(frame);
+        std::swap(previous, current);
+        return ok;
+    }
+};
+
+GifFrameCache::~GifFrameCache() {
+    if (decode_timer_ != nullptr) {
+        lv_timer_delete(decode_timer_);
+    }
+}
+
+void GifFrameCache::Request(const lv_img_dsc_t* gif, std::function<void(const GifAnimation*)> ready) {
+    auto it = animations_.find(gif);
+    if (it != animations_.end()) {
+        // Answers any older request too, it would only switch away from this one later
+        requested_ = nullptr;
+        ready_ = nullptr;
+        ready(it->second.get());
+        return;
+    }
+    requested_ = gif;
+    ready_ = std::move(ready);
+    if (job_ == nullptr || job_->gif != gif) {
+        decode_queue_.erase(std::remove(decode_queue_.begin(), decode_queue_.end(), gif), decode_queue_.end());
+        decode_queue_.push_front(gif);
+    }
+    StartDecoding();
+}
+
+void GifFrameCache::Preload(std::initializer_list<const lv_img_dsc_t*> gifs) {
+    decode_queue_.insert(decode_queue_.end(), gifs.begin(), gifs.end());
+    StartDecoding();
+}
+
+void GifFrameCache::StartDecoding() {
+    if (decode_timer_ != nullptr) {
+        return;
+    }
+    decode_timer_ = lv_timer_create([](lv_timer_t* timer) {
+        static_cast<GifFrameCache*>(lv_timer_get_user_data(timer))->DecodeNextFrames();
+    }, GIF_DECODE_INTERVAL_MS, this);
+}
+
+void GifFrameCache::DecodeNextFrames() {
+    while (job_ == nullptr) {
+        if (decode_queue_.empty()) {
+            ESP_LOGI(TAG, "Decoded %u GIFs, %u bytes used", (unsigned)animations_.size(), (unsigned)used_bytes_);
+            lv_timer_delete(decode_timer_);
+            decode_timer_ = nullptr;
+            return;
+        }
+        auto gif = decode_queue_.front();
+        decode_queue_.pop_front();
+        if (animations_.find(gif) == animations_.end()) {
+            job_ = std::make_unique<GifDecodeJob>(gif, background_);
+        }
+    }
+
+    if (job_->Step(GIF_DECODE_FRAMES_PER_TICK)) {
+        return;
+    }
+
+    // Only a complete animation is published
+    auto gif = job_->gif;
+    auto animation = job_->Take();
+    job_.reset();
+    const GifAnimation* result = nullptr;
+    if (animation != nullptr) {
+        used_bytes_ += animation->bytes();
+        result = animation.get();
+        animations_.emplace(gif, std::move(animation));
+    }
+    if (gif == requested_) {
+        requested_ = nullptr;
+        auto ready = std::move(ready_);
+        ready_ = nullptr;
+        ready(result);
+    }
+}
+
+void GifFrameCache::SetBackground(lv_color_t background) {
+    if (lv_color_eq(background, background_)) {
+        return;
+    }
+    background_ = background;
+    animations_.clear();
+    used_bytes_ = 0;
+    if (job_ != nullptr) {
+        // Its frames are blended over the old background, start it over
+        decode_queue_.push_front(job_->gif);
+        job_.reset();
+    }
+}
+
+GifPlayer::GifPlayer(lv_obj_t* parent) {
+    image_ = lv_image_create(parent);
+    lv_obj_set_size(image_, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+    lv_obj_set_style_border_width(image_, 0, 0);
+    lv_obj_center(image_);
+    lv_obj_add_event_cb(image_, [](lv_event_t* e) {
+        auto player = static_cast<GifPlayer*>(lv_event_get_user_data(e));
+        lv_timer_delete(player->timer_);
+        player->timer_ = nullptr;
+        player->image_ = nullptr;
+    }, LV_EVENT_DELETE, this);
+
+    timer_ = lv_timer_create([](lv_timer_t* timer) {
+        static_cast<GifPlayer*>(lv_timer_get_user_data(timer))->ShowNextFrame();
+    }, GIF_MIN_FRAME_DELAY_MS, this);
+    lv_timer_pause(timer_);
+
+    canvas_dsc_.header.magic = LV_IMAGE_HEADER_MAGIC;
+    canvas_dsc_.header.cf = LV_COLOR_FORMAT_RGB565;
+}
+
+GifPlayer::~GifPlayer() {
+    if (image_ != nullptr) {
+        // Deleting the image also deletes the timer
+        lv_obj_delete(image_);
+    }
+    if (canvas_ != nullptr) {
+        lv_image_cache_drop(&canvas_dsc_);
+        heap_caps_free(canvas_);
+    }
+}
+
+bool GifPlayer::ResizeCanvas(uint16_t width, uint16_t height) {
+    if (canvas_ != nullptr && canvas_dsc_.header.w == width && canvas_dsc_.header.h == height) {
+        return true;
+    }
+    if (canvas_ != nullptr) {
+        lv_image_set_src(image_, nullptr);
+        lv_image_cache_drop(&canvas_dsc_);
+        heap_caps_free(canvas_);
+    }
+    size_t size = width * height * sizeof(uint16_t);
+    canvas_ = (uint16_t*)heap_caps_malloc(size, GIF_CACHE_MALLOC_CAPS);
+    if (canvas_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the canvas", (unsigned)size);
+        return false;
+    }
+    canvas_dsc_.header.w = width;
+    canvas_dsc_.header.h = height;
+    canvas_dsc_.header.stride = width * sizeof(uint16_t);
+    canvas_dsc_.data_size = size;
+    canvas_dsc_.data = (const uint8_t*)canvas_;
+    return true;
+}
+
+void GifPlayer::Play(const GifAnimation* animation) {
+    if (image_ == nullptr || animation == nullptr || animation == animation_) {
+        return;
+    }
+    if (!ResizeCanvas(animation->width(), animation->height())) {
+        animation_ = nullptr;
+        lv_timer_pause(timer_);
+        return;
+    }
+
+    memcpy(canvas_, animation->keyframe(), canvas_dsc_.data_size);
+    lv_image_cache_drop(&canvas_dsc_);
+    lv_image_set_src(image_, &canvas_dsc_);
+    lv_obj_invalidate(image_);
+
+    animation_ = animation;
+    next_frame_ = 1 % animation->frames().size();
+    if (animation->frames().size() > 1) {
+        lv_timer_set_period(timer_, animation->frames()[0].delay_ms);
+        lv_timer_reset(timer_);
+        lv_timer_resume(timer_);
+    } else {
+        lv_timer_pause(timer_);
+    }
+}
+
+void GifPlayer::ShowNextFrame() {
+    if (animation_ == nullptr) {
+        return;
+    }
+    auto& frame = animation_->frames()[next_frame_];
+    next_frame_ = (next_frame_ + 1) % animation_->frames().size();
+    lv_timer_set_period(timer_, frame.delay_ms);
+    if (frame.width == 0) {
+        return;
+    }
+
+    uint16_t width = canvas_dsc_.header.w;
+    for (int y = 0; y < frame.height; y++) {
+        memcpy(canvas_ + (frame.y + y) * width + frame.x, frame.pixels + y * frame.width, frame.width * sizeof(uint16_t));
+    }
+    lv_image_cache_drop(&canvas_dsc_);
+
+    // Only the changed rectangle is redrawn and flushed to the panel
+    lv_area_t coords;
+    lv_obj_get_coords(image_, &coords);
+    lv_area_t area = {
+        .x1 = coords.x1 + frame.x,
+        .y1 = coords.y1 + frame.y,
+        .x2 = coords.x1 + frame.x + frame.width - 1,
+        .y2 = coords.y1 + frame.y + frame.height - 1,
+    };
+    lv_obj_invalidate_area(image_, &area);
+}
@@ -0,0 +1,131 @@
+#ifndef GIF_FRAME_CACHE_H
+#define GIF_FRAME_CACHE_H
+
+#include <lvgl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <vector>
+
+// GIFs asking for faster frames are slowed down, like browsers do
+#define GIF_MIN_FRAME_DELAY_MS 20
+// Frames decoded per LVGL timer tick, so a large GIF never stalls the UI for long
+#define GIF_DECODE_FRAMES_PER_TICK 1
+#define GIF_DECODE_INTERVAL_MS 10
+
+struct GifDecodeJob;
+
+/*
+ * One GIF decoded once into RGB565: a full keyframe plus, for every frame, only the
+ * rectangle that changed since the frame before. Frame 0 holds the change from the
+ * last frame back to the first, so looping never needs the full keyframe again.
+ */
+class GifAnimation {
+public:
+    struct Frame {
+        uint16_t x = 0;
+        uint16_t y = 0;
+        uint16_t width = 0;    // 0 if the frame repeats the one before
+        uint16_t height = 0;
+        uint16_t delay_ms = 0;
+        uint16_t* pixels = nullptr;
+    };
+
+    ~GifAnimation();
+    GifAnimation(const GifAnimation&) = delete;
+    GifAnimation& operator=(const GifAnimation&) = delete;
+
+    uint16_t width() const { return width_; }
+    uint16_t height() const { return height_; }
+    const uint16_t* keyframe() const { return keyframe_; }
+    const std::vector<Frame>& frames() const { return frames_; }
+    size_t bytes() const { return bytes_; }
+
+private:
+    uint16_t width_;
+    uint16_t height_;
+    uint16_t* keyframe_ = nullptr;
+    std::vector<Frame> frames_;
+    size_t bytes_ = 0;
+
+    // Built frame by frame by a GifDecodeJob
+    friend struct GifDecodeJob;
+    GifAnimation(uint16_t width, uint16_t height) : width_(width), height_(height) {}
+    bool SetDelta(const uint16_t* from, const uint16_t* to, Frame& frame);
+};
+
+/*
+ * Decoded GIF animations keyed by the asset address, kept in PSRAM for as long as the
+ * display lives, so switching emotions only costs a keyframe copy.
+ *
+ * GIFs are decoded GIF_DECODE_FRAMES_PER_TICK frames at a time on an LVGL timer, one GIF
+ * after the other, and an animation only enters the cache once all its frames are done.
+ *
+ * Only used from the LVGL task or under the display lock, like the widgets themselves.
+ */
+class GifFrameCache {
+public:
+    ~GifFrameCache();
+
+    // Calls ready with the animation, right away if it is cached, otherwise once it has been
+    // decoded (nullptr if the GIF is invalid or memory ran out). Only the latest request
+    // waiting for a decode is answered, so switching quickly ends on the last GIF asked for
+    void Request(const lv_img_dsc_t* gif, std::function<void(const GifAnimation*)> ready);
+    // Queues the GIFs for decoding behind any request, so the first switch to them is fast too
+    void Preload(std::initializer_list<const lv_img_dsc_t*> gifs);
+    // Drops the cache if the background changes, the frames are blended over it.
+    // Players showing a cached animation must be given a new one afterwards
+    void SetBackground(lv_color_t background);
+
+    size_t used_bytes() const { return used_bytes_; }
+
+private:
+    std::map<const lv_img_dsc_t*, std::unique_ptr<GifAnimation>> animations_;
+    std::deque<const lv_img_dsc_t*> decode_queue_;
+    std::unique_ptr<GifDecodeJob> job_;
+    lv_timer_t* decode_timer_ = nullptr;
+    const lv_img_dsc_t* requested_ = nullptr;
+    std::function<void(const GifAnimation*)> ready_;
+    lv_color_t background_ = lv_color_black();
+    size_t used_bytes_ = 0;
+
+    void StartDecoding();
+    void DecodeNextFrames();
+};
+
+/*
+ * Plays cached animations on an lv_image over a RGB565 canvas, copying and invalidating
+ * only the changed rectangle of each frame instead of redrawing the whole image.
+ *
+ * The image is a child of the parent passed in and is deleted with it, the player
+ * then stays idle until it is destroyed.
+ */
+class GifPlayer {
+public:
+    explicit GifPlayer(lv_obj_t* parent);
+    ~GifPlayer();
+    GifPlayer(const GifPlayer&) = delete;
+    GifPlayer& operator=(const GifPlayer&) = delete;
+
+    lv_obj_t* object() const { return image_; }
+    // Playing the animation that already runs keeps its position
+    void Play(const GifAnimation* animation);
+
+private:
+    lv_obj_t* image_ = nullptr;
+    lv_timer_t* timer_ = nullptr;
+    lv_image_dsc_t canvas_dsc_ = {};
+    uint16_t* canvas_ = nullptr;
+    const GifAnimation* animation_ = nullptr;
+    size_t next_frame_ = 0;
+
+    bool ResizeCanvas(uint16_t width, uint16_t height);
+    void ShowNextFrame();
+};
+
+#endif // GIF_FRAME_CACHE_H
@@ -0,0 +1,97 @@
+#include "headless_display_replay.h"
+#include "lcd_display.h"
+#include "assets/lang_config.h"
+
+#include <esp_log.h>
+
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#define TAG "DisplayReplay"
+
+// Longest a step may keep animations or display timers running before it counts as failed
+#define REPLAY_SETTLE_TIMEOUT_MS 5000
+#define REPLAY_CHAT_MESSAGES 30
+
+LV_FONT_DECLARE(font_puhui_16_4);
+LV_FONT_DECLARE(font_awesome_16_4);
+
+struct ReplayStep {
+    const char* name;
+    std::function<void(HeadlessLcdDisplay& display)> action;
+    // Screen checksum of a known good run at the default 240x240, 0 if none is recorded yet
+    uint32_t expected_checksum;
+};
+
+void RunHeadlessDisplayReplay() {
+    ESP_LOGI(TAG, "Replaying the UI script on a %dx%d headless display",
+        CONFIG_HEADLESS_DISPLAY_WIDTH, CONFIG_HEADLESS_DISPLAY_HEIGHT);
+    HeadlessLcdDisplay display(CONFIG_HEADLESS_DISPLAY_WIDTH, CONFIG_HEADLESS_DISPLAY_HEIGHT, {
+        .text_font = &font_puhui_16_4,
+        .icon_font = &font_awesome_16_4,
+        .emoji_font = font_emoji_64_init(),
+    });
+    // SetTheme saves the theme, the user's choice is put back at the end
+    std::string original_theme = display.GetTheme();
+
+    const ReplayStep steps[] = {
+        {"status", [](HeadlessLcdDisplay& display) {
+            display.SetStatus(Lang::Strings::CONNECTING);
+            display.SetStatus(Lang::Strings::LISTENING);
+            display.SetStatus(Lang::Strings::SPEAKING);
+            display.SetStatus(Lang::Strings::STANDBY);
+        }, 0},
+        {"notification", [](HeadlessLcdDisplay& display) {
+            // Measured after the notification timer has put the status text back
+            display.ShowNotification("Notification", 100);
+        }, 0},
+        {"chat", [](HeadlessLcdDisplay& display) {
+            for (int i = 0; i < REPLAY_CHAT_MESSAGES; i++) {
+                std::string text = "Message " + std::to_string(i) + ", long enough to wrap onto a second line of the chat";
+                display.SetChatMessage(i % 2 == 0 ? "user" : "assistant", text.c_str());
+            }
+            display.SetChatMessage("system", "System message");
+        }, 0},
+        {"emotion", [](HeadlessLcdDisplay& display) {
+            for (auto emotion : {"happy", "sad", "thinking", "angry", "neutral"}) {
+                display.SetEmotion(emotion);
+            }
+        }, 0},
+        {"theme", [](HeadlessLcdDisplay& display) {
+            display.SetTheme("dark");
+            display.SetTheme("light");
+        }, 0},
+    };
+    // The checksums depend on the resolution, so only the default one is compared
+    bool compare = CONFIG_HEADLESS_DISPLAY_WIDTH == 240 && CONFIG_HEADLESS_DISPLAY_HEIGHT == 240;
+
+    int mismatches = 0;
+    std::string checksums;
+    for (auto& step : steps) {
+        display.ResetRenderStats();
+        step.action(display);
+        // Wait for the chat scroll and the notification timer instead of sampling at a fixed time
+        if (!display.Settle(REPLAY_SETTLE_TIMEOUT_MS)) {
+            ESP_LOGE(TAG, "Step %s: the screen did not settle in %d ms", step.name, REPLAY_SETTLE_TIMEOUT_MS);
+            mismatches++;
+        }
+        uint32_t checksum = display.Checksum();
+        char hex[16];
+        snprintf(hex, sizeof(hex), "0x%08lx", (unsigned long)checksum);
+        checksums += checksums.empty() ? hex : std::string(", ") + hex;
+        if (!compare || step.expected_checksum == 0) {
+            ESP_LOGI(TAG, "Step %s: checksum %s", step.name, hex);
+        } else if (checksum == step.expected_checksum) {
+            ESP_LOGI(TAG, "Step %s: checksum %s as expected", step.name, hex);
+        } else {
+            ESP_LOGE(TAG, "Step %s: checksum %s, expected 0x%08lx", step.name, hex, (unsigned long)step.expected_checksum);
+            mismatches++;
+        }
+        display.LogRenderStats();
+    }
+
+    display.SetTheme(original_theme);
+    // In the order of the steps, to record them as the expected checksums of a known good build
+    ESP_LOGI(TAG, "Replay finished, %d failed step(s), checksums: %s", mismatches, checksums.c_str());
+}
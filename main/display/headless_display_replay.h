@@ -0,0 +1,10 @@
+#ifndef HEADLESS_DISPLAY_REPLAY_H
+#define HEADLESS_DISPLAY_REPLAY_H
+
+// Plays a fixed UI script on a HeadlessLcdDisplay and logs the render statistics and the
+// framebuffer checksum of every step, once the screen has settled. At the default resolution
+// the checksums are compared with the recorded ones. Runs instead of the application when
+// CONFIG_USE_HEADLESS_DISPLAY_REPLAY is enabled
+void RunHeadlessDisplayReplay();
+
+#endif // HEADLESS_DISPLAY_REPLAY_H
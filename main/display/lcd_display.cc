@@ -6,6 +6,10 @@
 #include <esp_log.h>
 #include <esp_err.h>
 #include <esp_lvgl_port.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "assets/lang_config.h"
 #include <cstring>
 #include "settings.h"
@@ -105,17 +109,44 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     ESP_LOGI(TAG, "Initialize LVGL port");
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
     port_cfg.task_priority = 1;
-    port_cfg.timer_period_ms = 50;
+    port_cfg.timer_period_ms = CONFIG_SPI_LCD_LVGL_TIMER_PERIOD_MS;
     lvgl_port_init(&port_cfg);
 
+    /*
+     * The port hands a band to the panel IO and marks it flushed from the DMA done callback.
+     * With two bands LVGL renders the next one while the last is still on the bus. With a
+     * PSRAM frame buffer a large dirty area is rendered in one pass and then copied band by
+     * band into an internal DMA buffer, as SPI DMA cannot read PSRAM.
+     */
+    uint32_t band_size = width_ * CONFIG_SPI_LCD_FLUSH_BAND_LINES;
+#if CONFIG_SPI_LCD_FLUSH_PSRAM_FRAME_BUFFER
+    uint32_t buffer_size = width_ * height_;
+    bool double_buffer = false;
+    uint32_t trans_size = band_size;
+    bool buff_dma = false;
+    bool buff_spiram = true;
+#else
+    uint32_t buffer_size = band_size;
+#if CONFIG_SPI_LCD_FLUSH_DOUBLE_BUFFER
+    bool double_buffer = true;
+#else
+    bool double_buffer = false;
+#endif
+    uint32_t trans_size = 0;
+    bool buff_dma = true;
+    bool buff_spiram = false;
+#endif
+    ESP_LOGI(TAG, "Flush buffer: %lu pixels%s, transfer band: %lu pixels", buffer_size,
+        double_buffer ? " x 2" : "", trans_size > 0 ? trans_size : buffer_size);
+
     ESP_LOGI(TAG, "Adding LCD screen");
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
-        .double_buffer = false,
-        .trans_size = 0,
+        .buffer_size = buffer_size,
+        .double_buffer = double_buffer,
+        .trans_size = trans_size,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
         .monochrome = false,
@@ -126,8 +157,8 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         },
         .color_format = LV_COLOR_FORMAT_RGB565,
         .flags = {
-            .buff_dma = 1,
-            .buff_spiram = 0,
+            .buff_dma = buff_dma,
+            .buff_spiram = buff_spiram,
             .sw_rotate = 0,
             .swap_bytes = 1,
             .full_refresh = 0,
@@ -269,6 +300,145 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     SetupUI();
 }
 
+HeadlessLcdDisplay::HeadlessLcdDisplay(int width, int height, DisplayFonts fonts)
+    : LcdDisplay(nullptr, nullptr, fonts, width, height) {
+    ESP_LOGI(TAG, "Initialize LVGL library");
+    lv_init();
+
+    ESP_LOGI(TAG, "Initialize LVGL port");
+    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    port_cfg.task_priority = 1;
+    port_cfg.timer_period_ms = 50;
+    lvgl_port_init(&port_cfg);
+
+#if CONFIG_SPIRAM
+    uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+#else
+    uint32_t caps = MALLOC_CAP_DEFAULT;
+#endif
+    // Same partial draw band as the SPI panels, so the measured cost matches them
+    uint32_t draw_buffer_size = width_ * CONFIG_SPI_LCD_FLUSH_BAND_LINES * sizeof(uint16_t);
+    framebuffer_ = (uint16_t*)heap_caps_calloc(width_ * height_, sizeof(uint16_t), caps);
+    draw_buffer_ = (uint8_t*)heap_caps_malloc(draw_buffer_size, MALLOC_CAP_DEFAULT);
+    if (framebuffer_ == nullptr || draw_buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate headless display buffers");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Adding headless screen");
+    lvgl_port_lock(0);
+    display_ = lv_display_create(width_, height_);
+    lv_display_set_color_format(display_, LV_COLOR_FORMAT_RGB565);
+    lv_display_set_buffers(display_, draw_buffer_, nullptr, draw_buffer_size, LV_DISPLAY_RENDER_MODE_PARTIAL);
+    lv_display_set_user_data(display_, this);
+    lv_display_set_flush_cb(display_, [](lv_display_t* disp, const lv_area_t* area, uint8_t* px_map) {
+        auto self = static_cast<HeadlessLcdDisplay*>(lv_display_get_user_data(disp));
+        int32_t width = lv_area_get_width(area);
+        auto pixels = (const uint16_t*)px_map;
+        for (int32_t y = area->y1; y <= area->y2; y++) {
+            memcpy(self->framebuffer_ + y * self->width_ + area->x1, pixels, width * sizeof(uint16_t));
+            pixels += width;
+        }
+        self->stats_.flushes++;
+        self->stats_.flushed_pixels += lv_area_get_size(area);
+        lv_display_flush_ready(disp);
+    });
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto self = static_cast<HeadlessLcdDisplay*>(lv_event_get_user_data(e));
+        self->render_start_time_ = esp_timer_get_time();
+    }, LV_EVENT_RENDER_START, this);
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto self = static_cast<HeadlessLcdDisplay*>(lv_event_get_user_data(e));
+        int64_t elapsed = esp_timer_get_time() - self->render_start_time_;
+        self->stats_.renders++;
+        self->stats_.render_time_us += elapsed;
+        self->stats_.max_render_time_us = std::max(self->stats_.max_render_time_us, elapsed);
+    }, LV_EVENT_RENDER_READY, this);
+    lvgl_port_unlock();
+
+    SetupUI();
+
+    // A circular scroll never ends, so the status text is clipped to keep the screen still
+    DisplayLockGuard lock(this);
+    if (status_label_ != nullptr) {
+        lv_label_set_long_mode(status_label_, LV_LABEL_LONG_CLIP);
+    }
+}
+
+HeadlessLcdDisplay::~HeadlessLcdDisplay() {
+    // The LVGL display must be gone before its buffers are freed, so it is torn down
+    // here in the same order as ~LcdDisplay, which then finds nothing left to delete
+    {
+        DisplayLockGuard lock(this);
+        for (auto obj : {&content_, &status_bar_, &side_bar_, &container_}) {
+            if (*obj != nullptr) {
+                lv_obj_del(*obj);
+                *obj = nullptr;
+            }
+        }
+        if (display_ != nullptr) {
+            lv_display_delete(display_);
+            display_ = nullptr;
+        }
+    }
+    heap_caps_free(draw_buffer_);
+    heap_caps_free(framebuffer_);
+}
+
+bool HeadlessLcdDisplay::Settle(int timeout_ms) {
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    int idle_polls = 0;
+    // Idle on two polls in a row, so a timer callback already waiting for the lock gets to run
+    while (idle_polls < 2) {
+        {
+            DisplayLockGuard lock(this);
+            bool busy = lv_anim_count_running() > 0 || esp_timer_is_active(notification_timer_) ||
+                esp_timer_is_active(status_bar_timer_);
+            idle_polls = busy ? 0 : idle_polls + 1;
+        }
+        if (idle_polls < 2) {
+            if (esp_timer_get_time() >= deadline) {
+                return false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+    DisplayLockGuard lock(this);
+    lv_refr_now(display_);
+    return true;
+}
+
+uint32_t HeadlessLcdDisplay::Checksum() {
+    DisplayLockGuard lock(this);
+    uint32_t hash = 2166136261u;
+    if (framebuffer_ == nullptr) {
+        return hash;
+    }
+    auto bytes = (const uint8_t*)framebuffer_;
+    for (size_t i = 0; i < width_ * height_ * sizeof(uint16_t); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+HeadlessLcdDisplay::RenderStats HeadlessLcdDisplay::GetRenderStats() {
+    DisplayLockGuard lock(this);
+    return stats_;
+}
+
+void HeadlessLcdDisplay::ResetRenderStats() {
+    DisplayLockGuard lock(this);
+    stats_ = RenderStats();
+}
+
+void HeadlessLcdDisplay::LogRenderStats() {
+    auto stats = GetRenderStats();
+    ESP_LOGI(TAG, "Renders: %lu, avg %lld us, max %lld us, flushes: %lu, pixels: %llu, free internal heap: %u",
+        (unsigned long)stats.renders, stats.renders > 0 ? stats.render_time_us / stats.renders : 0LL,
+        stats.max_render_time_us, (unsigned long)stats.flushes, stats.flushed_pixels,
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+}
+
 LcdDisplay::~LcdDisplay() {
     // 然后再清理 LVGL 对象
     if (content_ != nullptr) {
@@ -350,6 +520,14 @@ void LcdDisplay::SetupUI() {
     // We'll create chat messages dynamically in SetChatMessage
     chat_message_label_ = nullptr;
 
+    // 滚动到顶部时加载更早的消息
+    lv_obj_add_event_cb(content_, [](lv_event_t* e) {
+        auto self = static_cast<LcdDisplay*>(lv_event_get_user_data(e));
+        if (lv_obj_get_scroll_top(self->content_) <= 0) {
+            self->ShowOlderChatMessages();
+        }
+    }, LV_EVENT_SCROLL_END, this);
+
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
     lv_obj_set_style_pad_all(status_bar_, 0, 0);
@@ -418,187 +596,172 @@ void LcdDisplay::SetupUI() {
 #else
 #define  MAX_MESSAGES 20
 #endif
-void LcdDisplay::SetChatMessage(const char* role, const char* content) {
-    DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
-        return;
-    }
-    
-    //避免出现空的消息框
-    if(strlen(content) == 0) return;
-    
-    // 检查消息数量是否超过限制
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
-        }
-    }
-    
-    // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
-    if (strcmp(role, "system") == 0 && child_count > 0) {
-        // 获取最后一个消息容器
-        lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-        if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-            // 获取容器内的气泡
-            lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-            if (last_bubble != nullptr) {
-                // 检查气泡类型是否为系统消息
-                void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                    // 如果最后一个消息也是系统消息，则删除它
-                    lv_obj_del(last_container);
-                }
-            }
-        }
-    }
-    
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
+// 历史消息只保存文本，只有最近 MAX_MESSAGES 条绑定到 LVGL 对象上
+#define MAX_CHAT_HISTORY 100
+// 滚动到顶部时每次向前加载的消息条数
+#define CHAT_SCROLLBACK_STEP 5
+
+lv_obj_t* LcdDisplay::CreateChatRow() {
+    // Every message is a full-width transparent row holding the bubble, so rows of any role can be reused
+    lv_obj_t* row = lv_obj_create(content_);
+    lv_obj_set_width(row, LV_HOR_RES);
+    lv_obj_set_height(row, LV_SIZE_CONTENT);
+    lv_obj_set_style_bg_opa(row, LV_OPA_TRANSP, 0);
+    lv_obj_set_style_border_width(row, 0, 0);
+    lv_obj_set_style_pad_all(row, 0, 0);
+    lv_obj_set_scrollbar_mode(row, LV_SCROLLBAR_MODE_OFF);
+
+    lv_obj_t* msg_bubble = lv_obj_create(row);
     lv_obj_set_style_radius(msg_bubble, 8, 0);
     lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_style_border_width(msg_bubble, 1, 0);
-    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
     lv_obj_set_style_pad_all(msg_bubble, 8, 0);
+    lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
+    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+    lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
 
-    // Create the message text
     lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // 计算文本实际宽度
-    lv_coord_t text_width = lv_txt_get_width(content, strlen(content), fonts_.text_font, 0);
-
-    // 计算气泡宽度
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 屏幕宽度的85%
-    lv_coord_t min_width = 20;  
-    lv_coord_t bubble_width;
-    
-    // 确保文本宽度不小于最小宽度
-    if (text_width < min_width) {
-        text_width = min_width;
-    }
-
-    // 如果文本宽度小于最大宽度，使用文本宽度
-    if (text_width < max_width) {
-        bubble_width = text_width; 
-    } else {
-        bubble_width = max_width;
-    }
-    
-    // 设置消息文本的宽度
-    lv_obj_set_width(msg_text, bubble_width);  // 减去padding
     lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
     lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
 
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+    // Rows go away with content_, forget them then
+    lv_obj_add_event_cb(row, [](lv_event_t* e) {
+        auto self = static_cast<LcdDisplay*>(lv_event_get_user_data(e));
+        auto row = static_cast<lv_obj_t*>(lv_event_get_target(e));
+        auto it = std::find(self->chat_rows_.begin(), self->chat_rows_.end(), row);
+        if (it != self->chat_rows_.end()) {
+            self->chat_rows_.erase(it);
+        }
+    }, LV_EVENT_DELETE, this);
+    return row;
+}
 
-    // Set alignment and style based on message role
-    if (strcmp(role, "user") == 0) {
+void LcdDisplay::BindChatRow(lv_obj_t* row, const ChatRecord& record) {
+    lv_obj_t* msg_bubble = lv_obj_get_child(row, 0);
+    lv_obj_t* msg_text = lv_obj_get_child(msg_bubble, 0);
+    lv_label_set_text(msg_text, record.text.c_str());
+
+    // 计算文本实际宽度，气泡最宽为屏幕宽度的85%
+    lv_coord_t text_width = lv_txt_get_width(record.text.c_str(), record.text.size(), fonts_.text_font, 0);
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    lv_coord_t min_width = 20;
+    lv_obj_set_width(msg_text, std::clamp(text_width, min_width, max_width));
+
+    // 设置自定义属性标记气泡类型，SetTheme 依此更新颜色
+    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
+    if (record.role == kChatRoleUser) {
         // User messages are right-aligned with green background
         lv_obj_set_style_bg_color(msg_bubble, current_theme_.user_bubble, 0);
-        // Set text color for contrast
         lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "system") == 0) {
+        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
+    } else if (record.role == kChatRoleSystem) {
         // System messages are center-aligned with light gray background
         lv_obj_set_style_bg_color(msg_bubble, current_theme_.system_bubble, 0);
-        // Set text color for contrast
         lv_obj_set_style_text_color(msg_text, current_theme_.system_text, 0);
-        
-        // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
+    } else {
+        // Assistant messages are left-aligned
+        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
+        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
+        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
+        lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
+    }
+}
+
+void LcdDisplay::ShowLatestChatMessages() {
+    size_t visible = std::min<size_t>(chat_history_.size(), MAX_MESSAGES);
+    while (chat_rows_.size() < visible) {
+        chat_rows_.push_back(CreateChatRow());
+    }
+    chat_first_record_ = chat_history_.size() - visible;
+    for (size_t i = 0; i < chat_rows_.size(); i++) {
+        BindChatRow(chat_rows_[i], chat_history_[chat_first_record_ + i]);
+    }
+}
+
+void LcdDisplay::ShowOlderChatMessages() {
+    // Called from the LVGL task, which already holds the display lock
+    if (chat_first_record_ == 0 || chat_rows_.empty()) {
+        return;
+    }
+    lv_obj_t* old_first_row = chat_rows_.front();
+    size_t count = std::min<size_t>(CHAT_SCROLLBACK_STEP, chat_first_record_);
+    for (size_t i = 0; i < count; i++) {
+        lv_obj_t* row = chat_rows_.back();
+        chat_rows_.pop_back();
+        lv_obj_move_to_index(row, 0);
+        chat_rows_.push_front(row);
+        chat_first_record_--;
+        BindChatRow(row, chat_history_[chat_first_record_]);
+    }
+
+    // Keep the message the user was reading where it was
+    lv_obj_update_layout(content_);
+    lv_obj_scroll_to_y(content_, lv_obj_get_y(old_first_row), LV_ANIM_OFF);
+}
+
+void LcdDisplay::SetChatMessage(const char* role, const char* content) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr) {
+        return;
     }
     
-    // Create a full-width container for user messages to ensure right alignment
+    //避免出现空的消息框
+    if(strlen(content) == 0) return;
+
+    ChatRole chat_role = kChatRoleAssistant;
     if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
+        chat_role = kChatRoleUser;
     } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // 将气泡居中对齐在容器中
-        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
+        chat_role = kChatRoleSystem;
+    }
+
+    // New messages only touch one row while the newest messages are shown
+    bool showing_latest = !chat_rows_.empty() && chat_first_record_ + chat_rows_.size() == chat_history_.size();
+
+    // 折叠系统消息（如果最后一条也是系统消息，则直接替换它）
+    if (chat_role == kChatRoleSystem && !chat_history_.empty() && chat_history_.back().role == kChatRoleSystem) {
+        chat_history_.back().text = content;
+        if (showing_latest) {
+            BindChatRow(chat_rows_.back(), chat_history_.back());
+        } else {
+            ShowLatestChatMessages();
+        }
     } else {
-        // For assistant messages
-        // Left align assistant messages
-        lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
+        chat_history_.push_back({chat_role, content});
+        if (chat_history_.size() > MAX_CHAT_HISTORY) {
+            chat_history_.pop_front();
+            if (chat_first_record_ > 0) {
+                chat_first_record_--;
+            } else {
+                showing_latest = false;
+            }
+        }
 
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+        if (showing_latest && chat_rows_.size() < MAX_MESSAGES) {
+            chat_rows_.push_back(CreateChatRow());
+            BindChatRow(chat_rows_.back(), chat_history_.back());
+        } else if (showing_latest) {
+            // 复用最早的消息行，而不是删除后重新创建
+            lv_obj_t* row = chat_rows_.front();
+            chat_rows_.pop_front();
+            lv_obj_move_to_index(row, -1);
+            chat_rows_.push_back(row);
+            chat_first_record_++;
+            BindChatRow(row, chat_history_.back());
+        } else {
+            ShowLatestChatMessages();
+        }
     }
-    
+
+    // Auto-scroll to the newest message
+    lv_obj_t* last_row = chat_rows_.back();
+    lv_obj_scroll_to_view_recursive(last_row, LV_ANIM_ON);
+
     // Store reference to the latest message label
-    chat_message_label_ = msg_text;
+    chat_message_label_ = lv_obj_get_child(lv_obj_get_child(last_row, 0), 0);
 }
 #else
 void LcdDisplay::SetupUI() {
@@ -8,6 +8,8 @@
 #include <font_emoji.h>
 
 #include <atomic>
+#include <deque>
+#include <string>
 
 // Theme color structure
 struct ThemeColors {
@@ -37,6 +39,28 @@ protected:
     DisplayFonts fonts_;
     ThemeColors current_theme_;
 
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    enum ChatRole : uint8_t {
+        kChatRoleUser,
+        kChatRoleAssistant,
+        kChatRoleSystem,
+    };
+    struct ChatRecord {
+        ChatRole role;
+        std::string text;
+    };
+    // All kept messages, oldest first. Only a window of them is bound to LVGL rows
+    std::deque<ChatRecord> chat_history_;
+    // Rows in display order, reused for new messages instead of being recreated
+    std::deque<lv_obj_t*> chat_rows_;
+    size_t chat_first_record_ = 0;  // Index in chat_history_ shown by the first row
+
+    lv_obj_t* CreateChatRow();
+    void BindChatRow(lv_obj_t* row, const ChatRecord& record);
+    void ShowLatestChatMessages();
+    void ShowOlderChatMessages();
+#endif
+
     void SetupUI();
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
@@ -103,4 +127,36 @@ public:
                       bool mirror_x, bool mirror_y, bool swap_xy,
                       DisplayFonts fonts);
 };
+
+// 无屏显示器：LVGL 渲染到内存帧缓冲，用于测量界面渲染开销和比对画面
+class HeadlessLcdDisplay : public LcdDisplay {
+public:
+    struct RenderStats {
+        uint32_t renders = 0;           // Refreshes that drew at least one area
+        uint32_t flushes = 0;
+        uint64_t flushed_pixels = 0;
+        int64_t render_time_us = 0;
+        int64_t max_render_time_us = 0;
+    };
+
+    HeadlessLcdDisplay(int width, int height, DisplayFonts fonts);
+    ~HeadlessLcdDisplay();
+
+    // RGB565, width * height pixels, only stable while the display is locked
+    const uint16_t* framebuffer() const { return framebuffer_; }
+    // Waits until no LVGL animation and no display timer is pending, then renders the final
+    // frame, so the checksum does not depend on timing. False if it did not settle in time
+    bool Settle(int timeout_ms);
+    // FNV-1a of the framebuffer, to compare the screen against a known good one
+    uint32_t Checksum();
+    RenderStats GetRenderStats();
+    void ResetRenderStats();
+    void LogRenderStats();
+
+private:
+    uint16_t* framebuffer_ = nullptr;
+    uint8_t* draw_buffer_ = nullptr;
+    RenderStats stats_;
+    int64_t render_start_time_ = 0;
+};
 #endif // LCD_DISPLAY_H
@@ -7,6 +7,9 @@
 
 #include "application.h"
 #include "system_info.h"
+#if CONFIG_USE_HEADLESS_DISPLAY_REPLAY
+#include "display/headless_display_replay.h"
+#endif
 
 #define TAG "main"
 
@@ -24,6 +27,12 @@ extern "C" void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_USE_HEADLESS_DISPLAY_REPLAY
+    // UI benchmark firmware, renders into memory instead of running the application
+    RunHeadlessDisplayReplay();
+    return;
+#endif
+
     // Launch the application
     auto& app = Application::GetInstance();
     app.Start();
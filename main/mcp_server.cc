@@ -13,6 +13,8 @@
 #include "application.h"
 #include "display.h"
 #include "board.h"
+#include "audio_latency_trace.h"
+#include "json_writer.h"
 
 #define TAG "MCP"
 
@@ -56,6 +58,18 @@ void McpServer::AddCommonTools() {
             return true;
         });
     
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    AddTool("self.audio.get_latency_stats",
+        "Diagnostics: get the per-stage audio pipeline latency histograms (microphone to network, network to speaker).\n"
+        "Only use this tool when the user explicitly asks for audio latency statistics.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& tracer = AudioLatencyTracer::GetInstance();
+            tracer.Log();
+            return tracer.GetJson();
+        });
+#endif
+
     auto backlight = board.GetBacklight();
     if (backlight) {
         AddTool("self.screen.set_brightness",
@@ -193,9 +207,16 @@ void McpServer::ParseMessage(const cJSON* json) {
             }
         }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
-        message += app_desc->version;
-        message += "\"}}";
+        std::string message;
+        JsonWriter json(message);
+        json.BeginObject();
+        json.AddString("protocolVersion", "2024-11-05");
+        json.BeginObject("capabilities").BeginObject("tools").EndObject().EndObject();
+        json.BeginObject("serverInfo");
+        json.AddString("name", BOARD_NAME);
+        json.AddString("version", app_desc->version);
+        json.EndObject();
+        json.EndObject();
         ReplyResult(id_int, message);
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
@@ -238,29 +259,44 @@ void McpServer::ParseMessage(const cJSON* json) {
 }
 
 void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    // The payload is handed to the main loop, so it gets its own buffer sized up front
+    std::string payload;
+    payload.reserve(result.size() + 40);
+    JsonWriter json(payload);
+    json.BeginObject();
+    json.AddString("jsonrpc", "2.0");
+    json.AddNumber("id", id);
+    json.AddRaw("result", result);
+    json.EndObject();
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    std::string payload;
+    payload.reserve(message.size() + 60);
+    JsonWriter json(payload);
+    json.BeginObject();
+    json.AddString("jsonrpc", "2.0");
+    json.AddNumber("id", id);
+    json.BeginObject("error");
+    json.AddString("message", message);
+    json.EndObject();
+    json.EndObject();
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
 void McpServer::GetToolsList(int id, const std::string& cursor) {
     const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
+    std::string result;
+    result.reserve(max_payload_size);
+    JsonWriter json(result);
+    json.BeginObject();
+    json.BeginArray("tools");
     
     bool found_cursor = cursor.empty();
     auto it = tools_.begin();
     std::string next_cursor = "";
+    int tool_count = 0;
     
     while (it != tools_.end()) {
         // 如果我们还没有找到起始位置，继续搜索
@@ -273,36 +309,33 @@ void McpServer::GetToolsList(int id, const std::string& cursor) {
             }
         }
         
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
+        // 添加tool前检查大小，预留逗号和结尾的空间
+        std::string tool_json = (*it)->to_json();
+        if (json.str().length() + tool_json.length() + 31 > max_payload_size) {
             // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
             next_cursor = (*it)->name();
             break;
         }
         
-        json += tool_json;
+        json.AddRaw(nullptr, tool_json);
+        tool_count++;
         ++it;
     }
     
-    if (json.back() == ',') {
-        json.pop_back();
-    }
-    
-    if (json.back() == '[' && !tools_.empty()) {
+    if (tool_count == 0 && !tools_.empty()) {
         // 如果没有添加任何tool，返回错误
         ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
         ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
         return;
     }
 
-    if (next_cursor.empty()) {
-        json += "]}";
-    } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+    json.EndArray();
+    if (!next_cursor.empty()) {
+        json.AddString("nextCursor", next_cursor);
     }
+    json.EndObject();
     
-    ReplyResult(id, json);
+    ReplyResult(id, result);
 }
 
 void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size) {
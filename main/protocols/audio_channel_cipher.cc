@@ -0,0 +1,72 @@
+#include "audio_channel_cipher.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <arpa/inet.h>
+
+#define TAG "AudioChannelCipher"
+
+AudioChannelCipher::AudioChannelCipher() {
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+AudioChannelCipher::~AudioChannelCipher() {
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool AudioChannelCipher::SetKey(const std::string& key, const std::string& nonce) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_ = false;
+    if (key.size() != 16 || nonce.size() != AUDIO_CHANNEL_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid key (%u) or nonce (%u) size", key.size(), nonce.size());
+        return false;
+    }
+
+    // Drop the key schedule of the previous session before setting up the new one
+    mbedtls_aes_free(&aes_ctx_);
+    mbedtls_aes_init(&aes_ctx_);
+    if (mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), 128) != 0) {
+        ESP_LOGE(TAG, "Failed to set AES key");
+        return false;
+    }
+    memcpy(nonce_template_, nonce.data(), AUDIO_CHANNEL_NONCE_SIZE);
+    ready_ = true;
+    return true;
+}
+
+bool AudioChannelCipher::Encrypt(uint8_t* nonce, const uint8_t* input, uint8_t* output, uint16_t size,
+    uint32_t timestamp, uint32_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    BuildNonceLocked(nonce, size, timestamp, sequence);
+    return CryptLocked(nonce, input, output, size);
+}
+
+bool AudioChannelCipher::Crypt(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return CryptLocked(nonce, input, output, size);
+}
+
+void AudioChannelCipher::BuildNonceLocked(uint8_t* nonce, uint16_t payload_size, uint32_t timestamp, uint32_t sequence) const {
+    /*
+     * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+     */
+    memcpy(nonce, nonce_template_, AUDIO_CHANNEL_NONCE_SIZE);
+    uint16_t size_be = htons(payload_size);
+    uint32_t timestamp_be = htonl(timestamp);
+    uint32_t sequence_be = htonl(sequence);
+    memcpy(nonce + 2, &size_be, sizeof(size_be));
+    memcpy(nonce + 8, &timestamp_be, sizeof(timestamp_be));
+    memcpy(nonce + 12, &sequence_be, sizeof(sequence_be));
+}
+
+bool AudioChannelCipher::CryptLocked(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size) {
+    if (!ready_) {
+        return false;
+    }
+    // mbedtls advances the counter block it is given, so work on a copy of the nonce
+    uint8_t counter[AUDIO_CHANNEL_NONCE_SIZE];
+    memcpy(counter, nonce, sizeof(counter));
+    uint8_t stream_block[16];
+    size_t nc_off = 0;
+    return mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, input, output) == 0;
+}
@@ -0,0 +1,50 @@
+#ifndef AUDIO_CHANNEL_CIPHER_H
+#define AUDIO_CHANNEL_CIPHER_H
+
+#include <mbedtls/aes.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#define AUDIO_CHANNEL_NONCE_SIZE 16
+
+/*
+ * AES-128-CTR for the encrypted UDP audio channel, one instance per session.
+ *
+ * The key schedule and the nonce template from the server hello are set up once in
+ * SetKey(). Each packet only patches size, timestamp and sequence into a copy of the
+ * template. mbedtls uses the AES peripheral (DMA for longer buffers on chips that have
+ * it) when CONFIG_MBEDTLS_HARDWARE_AES is enabled, and software AES otherwise, e.g. on
+ * the linux target. Input and output may be the same buffer.
+ */
+class AudioChannelCipher {
+public:
+    AudioChannelCipher();
+    ~AudioChannelCipher();
+    AudioChannelCipher(const AudioChannelCipher&) = delete;
+    AudioChannelCipher& operator=(const AudioChannelCipher&) = delete;
+
+    // key and nonce are raw bytes, 16 each. Re-keying replaces the previous session
+    bool SetKey(const std::string& key, const std::string& nonce);
+    bool ready() const { return ready_; }
+
+    // Writes the packet header (the nonce) for an outgoing packet and encrypts the payload,
+    // both from the same session even if SetKey runs concurrently
+    bool Encrypt(uint8_t* nonce, const uint8_t* input, uint8_t* output, uint16_t size, uint32_t timestamp, uint32_t sequence);
+    // Encrypts or decrypts size bytes with the counter starting at nonce
+    bool Crypt(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size);
+
+private:
+    std::mutex mutex_;
+    mbedtls_aes_context aes_ctx_;
+    uint8_t nonce_template_[AUDIO_CHANNEL_NONCE_SIZE] = {};
+    bool ready_ = false;
+
+    // Both called with mutex_ held
+    void BuildNonceLocked(uint8_t* nonce, uint16_t payload_size, uint32_t timestamp, uint32_t sequence) const;
+    bool CryptLocked(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size);
+};
+
+#endif // AUDIO_CHANNEL_CIPHER_H
@@ -0,0 +1,241 @@
+#include "json_reader.h"
+
+#include <cstdint>
+#include <cstring>
+
+// Deeper values are rejected, so a hostile message cannot make the skip loop run away
+#define JSON_READER_MAX_DEPTH 32
+
+JsonReader::JsonReader(const char* data, size_t size) : json_(data, size) {
+    // Transports hand over NUL-terminated buffers, do not count the terminator as content
+    while (!json_.empty() && json_.back() == '\0') {
+        json_.remove_suffix(1);
+    }
+}
+
+bool JsonReader::IsObject() const {
+    size_t pos = SkipWhitespace(0);
+    return pos < json_.size() && json_[pos] == '{';
+}
+
+size_t JsonReader::SkipWhitespace(size_t pos) const {
+    while (pos < json_.size() && (json_[pos] == ' ' || json_[pos] == '\t' || json_[pos] == '\n' || json_[pos] == '\r')) {
+        pos++;
+    }
+    return pos;
+}
+
+size_t JsonReader::SkipString(size_t pos) const {
+    // pos is at the opening quote
+    for (pos++; pos < json_.size(); pos++) {
+        if (json_[pos] == '\\') {
+            pos++;
+        } else if (json_[pos] == '"') {
+            return pos + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+size_t JsonReader::SkipValue(size_t pos) const {
+    if (pos >= json_.size()) {
+        return std::string_view::npos;
+    }
+    char c = json_[pos];
+    if (c == '"') {
+        return SkipString(pos);
+    }
+    if (c != '{' && c != '[') {
+        // Number, true, false or null
+        while (pos < json_.size() && json_[pos] != ',' && json_[pos] != '}' && json_[pos] != ']' &&
+               json_[pos] != ' ' && json_[pos] != '\t' && json_[pos] != '\n' && json_[pos] != '\r') {
+            pos++;
+        }
+        return pos;
+    }
+
+    // Objects and arrays only need their brackets matched, strings may contain brackets
+    int depth = 0;
+    while (pos < json_.size()) {
+        c = json_[pos];
+        if (c == '"') {
+            pos = SkipString(pos);
+            if (pos == std::string_view::npos) {
+                return pos;
+            }
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            if (++depth > JSON_READER_MAX_DEPTH) {
+                return std::string_view::npos;
+            }
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return pos + 1;
+            }
+        }
+        pos++;
+    }
+    return std::string_view::npos;
+}
+
+bool JsonReader::Find(const char* key, size_t& value_start, size_t& value_end) const {
+    size_t key_length = strlen(key);
+    size_t pos = SkipWhitespace(0);
+    if (pos >= json_.size() || json_[pos] != '{') {
+        return false;
+    }
+    pos = SkipWhitespace(pos + 1);
+
+    while (pos < json_.size() && json_[pos] == '"') {
+        size_t key_end = SkipString(pos);
+        if (key_end == std::string_view::npos) {
+            return false;
+        }
+        bool match = key_end - pos - 2 == key_length && memcmp(json_.data() + pos + 1, key, key_length) == 0;
+
+        pos = SkipWhitespace(key_end);
+        if (pos >= json_.size() || json_[pos] != ':') {
+            return false;
+        }
+        pos = SkipWhitespace(pos + 1);
+        size_t end = SkipValue(pos);
+        if (end == std::string_view::npos) {
+            return false;
+        }
+        if (match) {
+            value_start = pos;
+            value_end = end;
+            return true;
+        }
+
+        pos = SkipWhitespace(end);
+        if (pos >= json_.size() || json_[pos] != ',') {
+            return false;
+        }
+        pos = SkipWhitespace(pos + 1);
+    }
+    return false;
+}
+
+std::string_view JsonReader::GetRaw(const char* key) const {
+    size_t start, end;
+    if (!Find(key, start, end)) {
+        return std::string_view();
+    }
+    return json_.substr(start, end - start);
+}
+
+std::string_view JsonReader::GetStringView(const char* key) const {
+    auto raw = GetRaw(key);
+    if (raw.size() < 2 || raw.front() != '"') {
+        return std::string_view();
+    }
+    return raw.substr(1, raw.size() - 2);
+}
+
+bool JsonReader::GetString(const char* key, std::string& value) const {
+    auto raw = GetRaw(key);
+    if (raw.size() < 2 || raw.front() != '"') {
+        return false;
+    }
+    return Unescape(raw.substr(1, raw.size() - 2), value);
+}
+
+cJSON* JsonReader::Parse(const char* key) const {
+    auto raw = GetRaw(key);
+    if (raw.empty()) {
+        return nullptr;
+    }
+    return cJSON_ParseWithLength(raw.data(), raw.size());
+}
+
+cJSON* JsonReader::ParseAll() const {
+    return cJSON_ParseWithLength(json_.data(), json_.size());
+}
+
+static void AppendUtf8(std::string& value, uint32_t code_point) {
+    if (code_point < 0x80) {
+        value.push_back(code_point);
+    } else if (code_point < 0x800) {
+        value.push_back(0xC0 | (code_point >> 6));
+        value.push_back(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        value.push_back(0xE0 | (code_point >> 12));
+        value.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        value.push_back(0x80 | (code_point & 0x3F));
+    } else {
+        value.push_back(0xF0 | (code_point >> 18));
+        value.push_back(0x80 | ((code_point >> 12) & 0x3F));
+        value.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        value.push_back(0x80 | (code_point & 0x3F));
+    }
+}
+
+static bool ParseHex4(std::string_view text, size_t pos, uint32_t& value) {
+    if (pos + 4 > text.size()) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        char c = text[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JsonReader::Unescape(std::string_view escaped, std::string& value) {
+    value.clear();
+    value.reserve(escaped.size());
+    for (size_t i = 0; i < escaped.size(); i++) {
+        char c = escaped[i];
+        if (c != '\\') {
+            value.push_back(c);
+            continue;
+        }
+        if (++i >= escaped.size()) {
+            return false;
+        }
+        switch (escaped[i]) {
+            case '"': value.push_back('"'); break;
+            case '\\': value.push_back('\\'); break;
+            case '/': value.push_back('/'); break;
+            case 'b': value.push_back('\b'); break;
+            case 'f': value.push_back('\f'); break;
+            case 'n': value.push_back('\n'); break;
+            case 'r': value.push_back('\r'); break;
+            case 't': value.push_back('\t'); break;
+            case 'u': {
+                uint32_t code_point;
+                if (!ParseHex4(escaped, i + 1, code_point)) {
+                    return false;
+                }
+                i += 4;
+                // A high surrogate must be followed by an escaped low surrogate
+                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                    uint32_t low;
+                    if (i + 2 >= escaped.size() || escaped[i + 1] != '\\' || escaped[i + 2] != 'u' ||
+                        !ParseHex4(escaped, i + 3, low) || low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                    i += 6;
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                }
+                AppendUtf8(value, code_point);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
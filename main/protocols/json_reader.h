@@ -0,0 +1,55 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <cJSON.h>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*
+ * Reads the fields of a JSON object straight from the message text, without building
+ * a cJSON tree.
+ *
+ * Server messages are small objects of which we need a few top-level strings (type,
+ * state, session_id, text) and now and then one subtree, such as the MCP payload.
+ * Each lookup scans the top level and skips over nested values, so nothing is
+ * allocated apart from the unescaped strings handed out. Parse() turns a single value
+ * into a cJSON tree when a consumer really needs one.
+ *
+ * The reader does not own the text, which must outlive it. Keys are compared as they
+ * appear in the text, escape sequences in keys are not decoded.
+ */
+class JsonReader {
+public:
+    JsonReader(const char* data, size_t size);
+    explicit JsonReader(std::string_view json) : JsonReader(json.data(), json.size()) {}
+
+    // The text starts with an object. Malformed content is only found by the lookups
+    bool IsObject() const;
+    std::string_view json() const { return json_; }
+
+    // Unescaped value of a top-level string, false if the key is missing or not a string
+    bool GetString(const char* key, std::string& value) const;
+    // Raw contents of a top-level string with escapes left as they are, for identifiers
+    // like type and state. Empty if the key is missing or not a string
+    std::string_view GetStringView(const char* key) const;
+    // Raw text of a top-level value of any type, empty if the key is missing
+    std::string_view GetRaw(const char* key) const;
+
+    // The caller owns the returned tree, nullptr if the key is missing or invalid
+    cJSON* Parse(const char* key) const;
+    cJSON* ParseAll() const;
+
+    static bool Unescape(std::string_view escaped, std::string& value);
+
+private:
+    std::string_view json_;
+
+    bool Find(const char* key, size_t& value_start, size_t& value_end) const;
+    size_t SkipWhitespace(size_t pos) const;
+    // Both return the position after the value, or std::string_view::npos if it is malformed
+    size_t SkipString(size_t pos) const;
+    size_t SkipValue(size_t pos) const;
+};
+
+#endif // JSON_READER_H
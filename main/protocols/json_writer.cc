@@ -0,0 +1,106 @@
+#include "json_writer.h"
+
+#include <cstdio>
+
+JsonWriter::JsonWriter(std::string& buffer) : buffer_(buffer) {
+    buffer_.clear();
+}
+
+void JsonWriter::AppendKey(const char* key) {
+    if (need_comma_) {
+        buffer_.push_back(',');
+    }
+    if (key != nullptr) {
+        buffer_.push_back('"');
+        Escape(key, buffer_);
+        buffer_.append("\":");
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject(const char* key) {
+    AppendKey(key);
+    buffer_.push_back('{');
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    buffer_.push_back('}');
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray(const char* key) {
+    AppendKey(key);
+    buffer_.push_back('[');
+    need_comma_ = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    buffer_.push_back(']');
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddString(const char* key, std::string_view value) {
+    AppendKey(key);
+    buffer_.push_back('"');
+    Escape(value, buffer_);
+    buffer_.push_back('"');
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddNumber(const char* key, int value) {
+    AppendKey(key);
+    char number[12];
+    int length = snprintf(number, sizeof(number), "%d", value);
+    buffer_.append(number, length);
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddBool(const char* key, bool value) {
+    AppendKey(key);
+    buffer_.append(value ? "true" : "false");
+    need_comma_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::AddRaw(const char* key, std::string_view json) {
+    AppendKey(key);
+    buffer_.append(json);
+    need_comma_ = true;
+    return *this;
+}
+
+void JsonWriter::Escape(std::string_view value, std::string& output) {
+    static const char hex[] = "0123456789abcdef";
+    // Copy runs of plain characters at once, UTF-8 sequences need no escaping
+    size_t start = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        output.append(value.data() + start, i - start);
+        start = i + 1;
+        output.push_back('\\');
+        switch (c) {
+            case '"': output.push_back('"'); break;
+            case '\\': output.push_back('\\'); break;
+            case '\b': output.push_back('b'); break;
+            case '\f': output.push_back('f'); break;
+            case '\n': output.push_back('n'); break;
+            case '\r': output.push_back('r'); break;
+            case '\t': output.push_back('t'); break;
+            default:
+                output.append("u00");
+                output.push_back(hex[c >> 4]);
+                output.push_back(hex[c & 0x0F]);
+                break;
+        }
+    }
+    output.append(value.data() + start, value.size() - start);
+}
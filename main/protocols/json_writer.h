@@ -0,0 +1,42 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+
+/*
+ * Serializes a JSON object straight into a caller-owned string, in the order the fields
+ * are added and with string values escaped.
+ *
+ * The buffer is cleared but keeps its capacity, so a sender that reuses one buffer stops
+ * allocating once it has seen its largest message. Nothing is checked beyond escaping,
+ * Begin and End calls must be balanced by the caller.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& buffer);
+
+    // Without a key for the top level object and for array elements
+    JsonWriter& BeginObject(const char* key = nullptr);
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray(const char* key = nullptr);
+    JsonWriter& EndArray();
+
+    JsonWriter& AddString(const char* key, std::string_view value);
+    JsonWriter& AddNumber(const char* key, int value);
+    JsonWriter& AddBool(const char* key, bool value);
+    // The value must already be valid JSON, e.g. an MCP payload
+    JsonWriter& AddRaw(const char* key, std::string_view json);
+
+    const std::string& str() const { return buffer_; }
+
+    static void Escape(std::string_view value, std::string& output);
+
+private:
+    std::string& buffer_;
+    bool need_comma_ = false;
+
+    void AppendKey(const char* key);
+};
+
+#endif // JSON_WRITER_H
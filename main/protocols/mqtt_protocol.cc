@@ -5,6 +5,7 @@
 
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -54,32 +55,37 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        JsonReader message(payload);
+        if (!message.IsObject()) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        auto type = message.GetStringView("type");
+        if (type.empty()) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
+        if (type == "hello") {
+            cJSON* root = message.ParseAll();
+            if (root == nullptr) {
+                ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+                return;
+            }
             ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            cJSON_Delete(root);
+        } else if (type == "goodbye") {
+            std::string session_id;
+            bool has_session_id = message.GetString("session_id", session_id);
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", has_session_id ? session_id.c_str() : "null");
+            if (!has_session_id || session_id_ == session_id) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+            on_incoming_json_(message);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -116,24 +122,26 @@ bool MqttProtocol::SendText(const std::string& text) {
 }
 
 bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    bool sent = SendAudioPacket(*packet);
+    AudioPacketPool::GetInstance().Release(std::move(packet));
+    return sent;
+}
+
+bool MqttProtocol::SendAudioPacket(AudioStreamPacket& packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    /*
+     * The Udp interface only sends std::string, so the packet is encrypted straight into
+     * a reused send buffer behind its nonce instead of being framed in the packet itself
+     */
+    auto& encrypted = udp_send_buffer_;
+    encrypted.resize(AUDIO_CHANNEL_NONCE_SIZE + packet.payload_size());
+    auto nonce = (uint8_t*)encrypted.data();
+    if (!cipher_.Encrypt(nonce, packet.payload_data(), nonce + AUDIO_CHANNEL_NONCE_SIZE, packet.payload_size(),
+        packet.timestamp, ++local_sequence_)) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
@@ -147,11 +155,15 @@ void MqttProtocol::CloseAudioChannel() {
         udp_.reset();
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    {
+        std::lock_guard<std::mutex> lock(text_mutex_);
+        JsonWriter json(text_buffer_);
+        json.BeginObject();
+        json.AddString("session_id", session_id_);
+        json.AddString("type", "goodbye");
+        json.EndObject();
+        SendText(text_buffer_);
+    }
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -170,9 +182,14 @@ bool MqttProtocol::OpenAudioChannel() {
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(text_mutex_);
+        JsonWriter json(text_buffer_);
+        WriteHelloMessage(json);
+        StartHelloRoundTrip();
+        if (!SendText(text_buffer_)) {
+            return false;
+        }
     }
 
     // 等待服务器响应
@@ -182,6 +199,7 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    FinishHelloRoundTrip();
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     auto network = Board::GetInstance().GetNetwork();
@@ -192,7 +210,7 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < AUDIO_CHANNEL_NONCE_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -202,33 +220,27 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+        // Out of order packets are passed on, the jitter buffer reorders them or drops them if too late
+        if (sequence <= remote_sequence_) {
+            ESP_LOGD(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+        } else if (sequence != remote_sequence_ + 1) {
+            ESP_LOGD(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
-        packet->sample_rate = server_sample_rate_;
-        packet->frame_duration = server_frame_duration_;
-        packet->timestamp = timestamp;
-        packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        size_t decrypted_size = data.size() - AUDIO_CHANNEL_NONCE_SIZE;
+        auto nonce = (const uint8_t*)data.data();
+        auto encrypted = nonce + AUDIO_CHANNEL_NONCE_SIZE;
+        auto packet = AcquireIncomingPacket(timestamp, nullptr, decrypted_size);
+        packet->sequence = sequence;
+        if (!cipher_.Crypt(nonce, encrypted, packet->payload.data(), decrypted_size)) {
+            ESP_LOGE(TAG, "Failed to decrypt audio data");
+            AudioPacketPool::GetInstance().Release(std::move(packet));
             return;
         }
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
+        CountIncomingSequence(sequence);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -240,29 +252,47 @@ bool MqttProtocol::OpenAudioChannel() {
     return true;
 }
 
-std::string MqttProtocol::GetHelloMessage() {
+void MqttProtocol::CountIncomingSequence(uint32_t sequence) {
+    remote_sequence_ = std::max(remote_sequence_, sequence);
+    if (loss_window_first_ == 0) {
+        loss_window_first_ = sequence;
+    }
+    loss_window_received_++;
+
+    uint32_t expected = remote_sequence_ - loss_window_first_ + 1;
+    if (expected < UDP_LOSS_REPORT_WINDOW) {
+        return;
+    }
+    // A sequence jump, e.g. a restarted server stream, is not loss
+    if (expected <= 2 * UDP_LOSS_REPORT_WINDOW) {
+        // Late packets of the previous window are counted here, so clamp
+        uint32_t received = std::min(loss_window_received_, expected);
+        ReportLink((expected - received) * 100 / expected);
+    }
+    loss_window_first_ = remote_sequence_ + 1;
+    loss_window_received_ = 0;
+}
+
+void MqttProtocol::WriteHelloMessage(JsonWriter& json) {
     // 发送 hello 消息申请 UDP 通道
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", 3);
-    cJSON_AddStringToObject(root, "transport", "udp");
-    cJSON* features = cJSON_CreateObject();
+    json.BeginObject();
+    json.AddString("type", "hello");
+    json.AddNumber("version", 3);
+    json.AddString("transport", "udp");
+    json.BeginObject("features");
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    json.AddBool("aec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
-    return message;
+    json.AddBool("mcp", true);
+    json.EndObject();
+    json.BeginObject("audio_params");
+    json.AddString("format", "opus");
+    json.AddNumber("sample_rate", 16000);
+    json.AddNumber("channels", 1);
+    json.AddNumber("frame_duration", OPUS_FRAME_DURATION_MS);
+    WriteUplinkBitrateRange(json);
+    json.EndObject();
+    json.EndObject();
 }
 
 void MqttProtocol::ParseServerHello(const cJSON* root) {
@@ -289,6 +319,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseUplinkBitrateRange(audio_params);
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -303,11 +334,13 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    if (!cipher_.SetKey(DecodeHexString(key), DecodeHexString(nonce))) {
+        return;
+    }
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    loss_window_first_ = 0;
+    loss_window_received_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
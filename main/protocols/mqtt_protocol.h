@@ -3,10 +3,10 @@
 
 
 #include "protocol.h"
+#include "audio_channel_cipher.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
@@ -17,6 +17,9 @@
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 10000
+// Downlink loss is reported once per this many UDP sequence numbers. It only stands in for
+// the uplink loss, which the device cannot measure, see UplinkRateController
+#define UDP_LOSS_REPORT_WINDOW 50
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
@@ -39,19 +42,25 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
+    AudioChannelCipher cipher_;
+    // Reused for every outgoing audio packet, guarded by channel_mutex_
+    std::string udp_send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    // Current loss window, from its first sequence number up to remote_sequence_
+    uint32_t loss_window_first_ = 0;
+    uint32_t loss_window_received_ = 0;
 
+    bool SendAudioPacket(AudioStreamPacket& packet);
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
+    void CountIncomingSequence(uint32_t sequence);
     std::string DecodeHexString(const std::string& hex_string);
 
     bool SendText(const std::string& text) override;
-    std::string GetHelloMessage();
+    void WriteHelloMessage(JsonWriter& json);
 };
 
 
@@ -1,10 +1,11 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const JsonReader& message)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -24,6 +25,14 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+void Protocol::OnLinkReport(std::function<void(uint32_t rtt_ms, uint32_t downlink_loss_percent)> callback) {
+    on_link_report_ = callback;
+}
+
+void Protocol::OnUplinkBitrateRange(std::function<void(int min_bitrate, int max_bitrate)> callback) {
+    on_uplink_bitrate_range_ = callback;
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -32,42 +41,119 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    std::lock_guard<std::mutex> lock(text_mutex_);
+    JsonWriter json(text_buffer_);
+    json.BeginObject();
+    json.AddString("session_id", session_id_);
+    json.AddString("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        json.AddString("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    json.EndObject();
+    SendText(text_buffer_);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    std::lock_guard<std::mutex> lock(text_mutex_);
+    JsonWriter json(text_buffer_);
+    json.BeginObject();
+    json.AddString("session_id", session_id_);
+    json.AddString("type", "listen");
+    json.AddString("state", "detect");
+    json.AddString("text", wake_word);
+    json.EndObject();
+    SendText(text_buffer_);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    std::lock_guard<std::mutex> lock(text_mutex_);
+    JsonWriter json(text_buffer_);
+    json.BeginObject();
+    json.AddString("session_id", session_id_);
+    json.AddString("type", "listen");
+    json.AddString("state", "start");
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        json.AddString("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        json.AddString("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        json.AddString("mode", "manual");
     }
-    message += "}";
-    SendText(message);
+    json.EndObject();
+    SendText(text_buffer_);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    std::lock_guard<std::mutex> lock(text_mutex_);
+    JsonWriter json(text_buffer_);
+    json.BeginObject();
+    json.AddString("session_id", session_id_);
+    json.AddString("type", "listen");
+    json.AddString("state", "stop");
+    json.EndObject();
+    SendText(text_buffer_);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
-    SendText(message);
+    std::lock_guard<std::mutex> lock(text_mutex_);
+    JsonWriter json(text_buffer_);
+    json.BeginObject();
+    json.AddString("session_id", session_id_);
+    json.AddString("type", "mcp");
+    json.AddRaw("payload", payload);
+    json.EndObject();
+    SendText(text_buffer_);
+}
+
+void Protocol::WriteUplinkBitrateRange(JsonWriter& json) {
+#if CONFIG_USE_ADAPTIVE_UPLINK_BITRATE
+    // The server may answer with a narrower range in its hello audio_params
+    json.AddNumber("min_bitrate", CONFIG_UPLINK_OPUS_MIN_BITRATE);
+    json.AddNumber("max_bitrate", CONFIG_UPLINK_OPUS_MAX_BITRATE);
+#endif
+}
+
+void Protocol::ParseUplinkBitrateRange(const cJSON* audio_params) {
+    auto min_bitrate = cJSON_GetObjectItem(audio_params, "min_bitrate");
+    auto max_bitrate = cJSON_GetObjectItem(audio_params, "max_bitrate");
+    if (!cJSON_IsNumber(min_bitrate) || !cJSON_IsNumber(max_bitrate)) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink bitrate range: %d - %d", min_bitrate->valueint, max_bitrate->valueint);
+    if (on_uplink_bitrate_range_ != nullptr) {
+        on_uplink_bitrate_range_(min_bitrate->valueint, max_bitrate->valueint);
+    }
+}
+
+void Protocol::StartHelloRoundTrip() {
+    hello_sent_us_ = esp_timer_get_time();
+}
+
+void Protocol::FinishHelloRoundTrip() {
+    hello_rtt_ms_ = (esp_timer_get_time() - hello_sent_us_) / 1000;
+    ESP_LOGI(TAG, "Hello round trip: %lu ms", hello_rtt_ms_);
+    ReportLink(0);
+}
+
+void Protocol::ReportLink(uint32_t downlink_loss_percent) {
+    if (on_link_report_ != nullptr) {
+        on_link_report_(hello_rtt_ms_, downlink_loss_percent);
+    }
+}
+
+std::unique_ptr<AudioStreamPacket> Protocol::AcquireIncomingPacket(uint32_t timestamp, const uint8_t* payload, size_t size) {
+    auto packet = AudioPacketPool::GetInstance().Acquire();
+    packet->sample_rate = server_sample_rate_;
+    packet->frame_duration = server_frame_duration_;
+    packet->timestamp = timestamp;
+    packet->sequence = 0;
+    packet->payload_offset = 0;
+    if (payload != nullptr) {
+        packet->payload.assign(payload, payload + size);
+    } else {
+        packet->payload.resize(size);
+    }
+    return packet;
 }
 
 bool Protocol::IsTimeout() const {
@@ -6,12 +6,56 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <mutex>
+#include <cstring>
+
+#include "audio_frame_pool.h"
+#include "audio_latency_trace.h"
+#include "json_reader.h"
+#include "json_writer.h"
+
+// Largest transport header written in front of an audio payload (BinaryProtocol2, MQTT UDP nonce)
+#define AUDIO_PACKET_HEADROOM 16
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // Transport sequence number, 0 if the transport is ordered (websocket)
     std::vector<uint8_t> payload;
+    // Bytes at the front of payload that are not sent. The uplink encoder leaves
+    // AUDIO_PACKET_HEADROOM of them, so a transport header can be written in place
+    size_t payload_offset = 0;
+    [[no_unique_address]] AudioTraceStamps trace;
+
+    // The Opus packet, or the framed message once PrependHeader() has run
+    const uint8_t* payload_data() const { return payload.data() + payload_offset; }
+    size_t payload_size() const { return payload.size() - payload_offset; }
+
+    // Frames the payload for a transport by writing the header into the headroom in front
+    // of it. Only packets without enough headroom (the wake word pre-roll) move the payload
+    void PrependHeader(const void* header, size_t size) {
+        auto bytes = static_cast<const uint8_t*>(header);
+        if (payload_offset >= size) {
+            payload_offset -= size;
+            memcpy(payload.data() + payload_offset, bytes, size);
+        } else {
+            payload.insert(payload.begin() + payload_offset, bytes, bytes + size);
+        }
+    }
+};
+
+/*
+ * The Opus packets of both directions, shared by AudioService and the transports. The
+ * encoder and the receivers acquire packets, SendAudio() and the decoder release them,
+ * so a session keeps recycling the same payload buffers.
+ */
+class AudioPacketPool : public AudioFramePool<AudioStreamPacket> {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance;
+        return instance;
+    }
 };
 
 struct BinaryProtocol2 {
@@ -30,6 +74,16 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+// Message type of a BinaryProtocol2/3 message whose payload is a run of BinaryProtocolFrame.
+// Only sent when both sides agreed on frames_per_packet in the hello audio_params
+#define BINARY_PROTOCOL_TYPE_OPUS_BATCH 2
+
+struct BinaryProtocolFrame {
+    uint32_t timestamp;     // Timestamp in milliseconds
+    uint16_t payload_size;  // Opus packet size in bytes
+    uint8_t payload[];
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -56,16 +110,24 @@ public:
     }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    void OnIncomingJson(std::function<void(const JsonReader& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
+    // Link feedback for the uplink bitrate controller: round trip time and the loss seen on
+    // the downlink, which is only a proxy for the uplink, and the uplink bitrate range the
+    // server accepted in its hello
+    void OnLinkReport(std::function<void(uint32_t rtt_ms, uint32_t downlink_loss_percent)> callback);
+    void OnUplinkBitrateRange(std::function<void(int min_bitrate, int max_bitrate)> callback);
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
+    // Takes the packet back to AudioPacketPool once it has been sent or dropped
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Sends out uplink audio held back by the transport, e.g. when the speaker stops talking
+    virtual void FlushAudio() {}
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -73,21 +135,38 @@ public:
     virtual void SendMcpMessage(const std::string& message);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const JsonReader& message)> on_incoming_json_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
+    std::function<void(uint32_t rtt_ms, uint32_t downlink_loss_percent)> on_link_report_;
+    std::function<void(int min_bitrate, int max_bitrate)> on_uplink_bitrate_range_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    // Outgoing text messages are serialized into one reused buffer
+    std::mutex text_mutex_;
+    std::string text_buffer_;
+    // Round trip of the last hello exchange, the only RTT sample both transports have
+    int64_t hello_sent_us_ = 0;
+    uint32_t hello_rtt_ms_ = 0;
 
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    void WriteUplinkBitrateRange(JsonWriter& json);
+    void ParseUplinkBitrateRange(const cJSON* audio_params);
+    // Called right before sending the hello and once the server hello arrived
+    void StartHelloRoundTrip();
+    void FinishHelloRoundTrip();
+    void ReportLink(uint32_t downlink_loss_percent);
+    // A pooled downlink packet with the server audio parameters and size bytes of payload,
+    // copied from payload unless it is nullptr
+    std::unique_ptr<AudioStreamPacket> AcquireIncomingPacket(uint32_t timestamp, const uint8_t* payload, size_t size);
 };
 
 #endif // PROTOCOL_H
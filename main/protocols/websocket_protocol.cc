@@ -5,6 +5,7 @@
 #include "settings.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
@@ -14,9 +15,28 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t batch_timer_args = {
+        .callback = [](void* arg) {
+            // Sending may block on the network, so do it from the main task
+            auto protocol = (WebsocketProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->FlushAudio();
+            }, kTaskPriorityHigh);
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_audio_batch",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&batch_timer_args, &batch_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (batch_timer_ != nullptr) {
+        esp_timer_stop(batch_timer_);
+        esp_timer_delete(batch_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -26,35 +46,118 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    bool sent = SendAudioPacket(*packet);
+    AudioPacketPool::GetInstance().Release(std::move(packet));
+    return sent;
+}
+
+bool WebsocketProtocol::SendAudioPacket(AudioStreamPacket& packet) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    if (batch_frames_ > 1) {
+        return AppendToBatch(packet);
+    }
+
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        BinaryProtocol2 bp2;
+        bp2.version = htons(version_);
+        bp2.type = 0;
+        bp2.reserved = 0;
+        bp2.timestamp = htonl(packet.timestamp);
+        bp2.payload_size = htonl(packet.payload_size());
+        packet.PrependHeader(&bp2, sizeof(bp2));
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        BinaryProtocol3 bp3;
+        bp3.type = 0;
+        bp3.reserved = 0;
+        bp3.payload_size = htons(packet.payload_size());
+        packet.PrependHeader(&bp3, sizeof(bp3));
+    }
+    return websocket_->Send(packet.payload_data(), packet.payload_size(), true);
+}
+
+bool WebsocketProtocol::AppendToBatch(const AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    size_t header_size = version_ == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3);
+    size_t frame_size = sizeof(BinaryProtocolFrame) + packet.payload_size();
+
+    // BinaryProtocol3 carries a 16-bit payload size
+    if (batch_count_ > 0 && batch_buffer_.size() - header_size + frame_size > UINT16_MAX) {
+        if (!SendBatch()) {
+            return false;
+        }
+    }
+
+    if (batch_count_ == 0) {
+        // The header is filled in by SendBatch() once the total size is known
+        batch_buffer_.resize(header_size);
+        batch_timestamp_ = packet.timestamp;
+        batch_started_us_ = esp_timer_get_time();
+        esp_timer_start_once(batch_timer_, CONFIG_WEBSOCKET_AUDIO_BATCH_MAX_LATENCY_MS * 1000);
+    }
+
+    BinaryProtocolFrame frame;
+    frame.timestamp = htonl(packet.timestamp);
+    frame.payload_size = htons(packet.payload_size());
+    auto frame_bytes = (const uint8_t*)&frame;
+    batch_buffer_.insert(batch_buffer_.end(), frame_bytes, frame_bytes + sizeof(frame));
+    batch_buffer_.insert(batch_buffer_.end(), packet.payload_data(), packet.payload_data() + packet.payload_size());
+    batch_count_++;
+
+    if (batch_count_ >= batch_frames_ ||
+        esp_timer_get_time() - batch_started_us_ >= CONFIG_WEBSOCKET_AUDIO_BATCH_MAX_LATENCY_MS * 1000) {
+        return SendBatch();
+    }
+    return true;
+}
+
+// Requires batch_mutex_
+bool WebsocketProtocol::SendBatch() {
+    if (batch_count_ == 0) {
+        return true;
+    }
+    esp_timer_stop(batch_timer_);
+    batch_count_ = 0;
+
+    if (version_ == 2) {
+        BinaryProtocol2 bp2;
+        bp2.version = htons(version_);
+        bp2.type = htons(BINARY_PROTOCOL_TYPE_OPUS_BATCH);
+        bp2.reserved = 0;
+        bp2.timestamp = htonl(batch_timestamp_);
+        bp2.payload_size = htonl(batch_buffer_.size() - sizeof(bp2));
+        memcpy(batch_buffer_.data(), &bp2, sizeof(bp2));
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        BinaryProtocol3 bp3;
+        bp3.type = BINARY_PROTOCOL_TYPE_OPUS_BATCH;
+        bp3.reserved = 0;
+        bp3.payload_size = htons(batch_buffer_.size() - sizeof(bp3));
+        memcpy(batch_buffer_.data(), &bp3, sizeof(bp3));
+    }
+
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
     }
+    return websocket_->Send(batch_buffer_.data(), batch_buffer_.size(), true);
+}
+
+void WebsocketProtocol::DiscardBatch() {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    esp_timer_stop(batch_timer_);
+    batch_count_ = 0;
+}
+
+void WebsocketProtocol::FlushAudio() {
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    SendBatch();
+}
+
+void WebsocketProtocol::SendStopListening() {
+    // The server must have all the audio before it sees the end of the utterance
+    FlushAudio();
+    Protocol::SendStopListening();
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -76,6 +179,7 @@ bool WebsocketProtocol::IsAudioChannelOpened() const {
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    DiscardBatch();
     websocket_.reset();
 }
 
@@ -89,6 +193,9 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    // Stays off until the server hello agrees on it
+    DiscardBatch();
+    batch_frames_ = 1;
 
     auto network = Board::GetInstance().GetNetwork();
     websocket_ = network->CreateWebSocket(1);
@@ -113,53 +220,53 @@ bool WebsocketProtocol::OpenAudioChannel() {
             if (on_incoming_audio_ != nullptr) {
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
+                    if (len < sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Binary message too short: %u", len);
+                        return;
+                    }
                     bp2->version = ntohs(bp2->version);
                     bp2->type = ntohs(bp2->type);
                     bp2->timestamp = ntohl(bp2->timestamp);
                     bp2->payload_size = ntohl(bp2->payload_size);
+                    if (bp2->payload_size > len - sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Invalid payload size %lu in a message of %u bytes", bp2->payload_size, len);
+                        return;
+                    }
                     auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
+                    on_incoming_audio_(AcquireIncomingPacket(bp2->timestamp, payload, bp2->payload_size));
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
+                    if (len < sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Binary message too short: %u", len);
+                        return;
+                    }
                     bp3->type = bp3->type;
                     bp3->payload_size = ntohs(bp3->payload_size);
+                    if (bp3->payload_size > len - sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Invalid payload size %u in a message of %u bytes", bp3->payload_size, len);
+                        return;
+                    }
                     auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+                    on_incoming_audio_(AcquireIncomingPacket(0, payload, bp3->payload_size));
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    on_incoming_audio_(AcquireIncomingPacket(0, (const uint8_t*)data, len));
                 }
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
+            // Dispatch on the type without building a tree, only the hello is parsed in full
+            JsonReader message(data, len);
+            auto type = message.GetStringView("type");
+            if (type == "hello") {
+                auto root = message.ParseAll();
+                ParseServerHello(root);
+                cJSON_Delete(root);
+            } else if (!type.empty()) {
+                if (on_incoming_json_ != nullptr) {
+                    on_incoming_json_(message);
                 }
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -179,9 +286,14 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(text_mutex_);
+        JsonWriter json(text_buffer_);
+        WriteHelloMessage(json);
+        StartHelloRoundTrip();
+        if (!SendText(text_buffer_)) {
+            return false;
+        }
     }
 
     // Wait for server hello
@@ -191,6 +303,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    FinishHelloRoundTrip();
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -199,29 +312,31 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
-std::string WebsocketProtocol::GetHelloMessage() {
+void WebsocketProtocol::WriteHelloMessage(JsonWriter& json) {
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", version_);
-    cJSON* features = cJSON_CreateObject();
+    json.BeginObject();
+    json.AddString("type", "hello");
+    json.AddNumber("version", version_);
+    json.BeginObject("features");
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    json.AddBool("aec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
-    return message;
+    json.AddBool("mcp", true);
+    json.EndObject();
+    json.AddString("transport", "websocket");
+    json.BeginObject("audio_params");
+    json.AddString("format", "opus");
+    json.AddNumber("sample_rate", 16000);
+    json.AddNumber("channels", 1);
+    json.AddNumber("frame_duration", OPUS_FRAME_DURATION_MS);
+    WriteUplinkBitrateRange(json);
+    // Batches are carried by the BinaryProtocol2/3 header, protocol version 1 has none
+    if (CONFIG_WEBSOCKET_AUDIO_BATCH_FRAMES > 1 && (version_ == 2 || version_ == 3)) {
+        json.AddNumber("frames_per_packet", CONFIG_WEBSOCKET_AUDIO_BATCH_FRAMES);
+        json.AddNumber("max_batch_latency_ms", CONFIG_WEBSOCKET_AUDIO_BATCH_MAX_LATENCY_MS);
+    }
+    json.EndObject();
+    json.EndObject();
 }
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
@@ -247,6 +362,13 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseUplinkBitrateRange(audio_params);
+        // The server echoes frames_per_packet, possibly lowered, if it accepts batched uplink audio
+        auto frames_per_packet = cJSON_GetObjectItem(audio_params, "frames_per_packet");
+        if (cJSON_IsNumber(frames_per_packet) && (version_ == 2 || version_ == 3)) {
+            batch_frames_ = std::clamp(frames_per_packet->valueint, 1, CONFIG_WEBSOCKET_AUDIO_BATCH_FRAMES);
+            ESP_LOGI(TAG, "Uplink audio batching: %d frames per message", batch_frames_);
+        }
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
@@ -7,6 +7,9 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+#include <mutex>
+#include <vector>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
@@ -17,6 +20,8 @@ public:
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    void FlushAudio() override;
+    void SendStopListening() override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -26,9 +31,22 @@ private:
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
 
+    // Uplink batching, enabled when the server accepts frames_per_packet in its hello
+    int batch_frames_ = 1;
+    int batch_count_ = 0;
+    uint32_t batch_timestamp_ = 0;
+    int64_t batch_started_us_ = 0;
+    std::vector<uint8_t> batch_buffer_;
+    std::mutex batch_mutex_;
+    esp_timer_handle_t batch_timer_ = nullptr;
+
+    bool SendAudioPacket(AudioStreamPacket& packet);
+    bool AppendToBatch(const AudioStreamPacket& packet);
+    bool SendBatch();
+    void DiscardBatch();
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
-    std::string GetHelloMessage();
+    void WriteHelloMessage(JsonWriter& json);
 };
 
 #endif
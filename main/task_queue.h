@@ -0,0 +1,253 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Captures up to this size are stored in the task itself, e.g. [this, std::string]
+#define INLINE_TASK_SIZE 32
+#define TASK_QUEUE_HIGH_CAPACITY 16
+#define TASK_QUEUE_NORMAL_CAPACITY 32
+
+enum TaskPriority {
+    kTaskPriorityHigh,      // Work that may run before anything queued as normal, never state transitions
+    kTaskPriorityNormal,
+};
+
+/*
+ * A move-only void() callable that keeps small captures inline instead of on the heap,
+ * unlike std::function, whose small buffer is too small for most of our lambdas.
+ * Larger callables still work, they are moved to the heap.
+ */
+class InlineTask {
+public:
+    InlineTask() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineTask>>>
+    InlineTask(F&& callable) {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= INLINE_TASK_SIZE && alignof(T) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<T>) {
+            new (storage_) T(std::forward<F>(callable));
+            ops_ = &kInlineOps<T>;
+        } else {
+            *reinterpret_cast<T**>(storage_) = new T(std::forward<F>(callable));
+            ops_ = &kHeapOps<T>;
+        }
+    }
+
+    InlineTask(InlineTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() {
+        Reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    bool on_heap() const { return ops_ != nullptr && ops_->on_heap; }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Move constructs into dst and destroys src
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void* storage);
+        bool on_heap;
+    };
+
+    template <typename T>
+    static constexpr Ops kInlineOps = {
+        [](void* storage) { (*static_cast<T*>(storage))(); },
+        [](void* dst, void* src) {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        },
+        [](void* storage) { static_cast<T*>(storage)->~T(); },
+        false,
+    };
+
+    template <typename T>
+    static constexpr Ops kHeapOps = {
+        [](void* storage) { (**static_cast<T**>(storage))(); },
+        [](void* dst, void* src) { *static_cast<T**>(dst) = *static_cast<T**>(src); },
+        [](void* storage) { delete *static_cast<T**>(storage); },
+        true,
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_TASK_SIZE];
+    const Ops* ops_ = nullptr;
+
+    void MoveFrom(InlineTask& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->relocate(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+/*
+ * A bounded lock-free ring of InlineTask for many producers and one consumer.
+ *
+ * Each slot carries a sequence number (Vyukov's bounded queue), so a producer claims
+ * a slot with one compare-exchange and publishes it with one release store. Nothing
+ * is allocated after construction.
+ */
+template <size_t Capacity>
+class TaskRing {
+public:
+    TaskRing() {
+        for (size_t i = 0; i < Capacity; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    TaskRing(const TaskRing&) = delete;
+    TaskRing& operator=(const TaskRing&) = delete;
+
+    // On success the task is moved into the ring, otherwise it is left untouched
+    bool Push(InlineTask& task) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos % Capacity];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->task = std::move(task);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the consumer
+    bool Pop(InlineTask& task) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[pos % Capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+        task = std::move(slot.task);
+        slot.sequence.store(pos + Capacity, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        InlineTask task;
+    };
+
+    Slot slots_[Capacity];
+    std::atomic<size_t> enqueue_pos_ = 0;
+    std::atomic<size_t> dequeue_pos_ = 0;
+};
+
+/*
+ * The main loop's queue: a high and a normal priority ring, drained high first.
+ *
+ * When a ring is full the task goes to a mutex-guarded overflow list instead of being
+ * dropped. Later tasks of that priority follow it there until the consumer has caught
+ * up, so the tasks of one producer still run in the order they were pushed.
+ */
+class TaskQueue {
+public:
+    template <typename F>
+    void Push(F&& callable, TaskPriority priority) {
+        InlineTask task(std::forward<F>(callable));
+        if (task.on_heap()) {
+            heap_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+        auto& lane = lanes_[priority];
+        if (lane.overflow_size.load(std::memory_order_acquire) == 0 && PushToRing(task, priority)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(lane.overflow_mutex);
+        lane.overflow.push_back(std::move(task));
+        lane.overflow_size.store(lane.overflow.size(), std::memory_order_release);
+        overflow_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Only called by the consumer
+    bool Pop(InlineTask& task) {
+        for (int priority = kTaskPriorityHigh; priority <= kTaskPriorityNormal; priority++) {
+            if (PopFromRing(task, TaskPriority(priority))) {
+                return true;
+            }
+            auto& lane = lanes_[priority];
+            if (lane.overflow_size.load(std::memory_order_acquire) > 0) {
+                std::lock_guard<std::mutex> lock(lane.overflow_mutex);
+                task = std::move(lane.overflow.front());
+                lane.overflow.pop_front();
+                lane.overflow_size.store(lane.overflow.size(), std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Tasks that did not fit in their ring, and tasks whose captures did not fit inline
+    uint32_t overflow_count() const { return overflow_count_.load(std::memory_order_relaxed); }
+    uint32_t heap_count() const { return heap_count_.load(std::memory_order_relaxed); }
+
+private:
+    struct Lane {
+        std::mutex overflow_mutex;
+        std::deque<InlineTask> overflow;
+        std::atomic<size_t> overflow_size = 0;
+    };
+
+    TaskRing<TASK_QUEUE_HIGH_CAPACITY> high_;
+    TaskRing<TASK_QUEUE_NORMAL_CAPACITY> normal_;
+    Lane lanes_[2];
+    std::atomic<uint32_t> overflow_count_ = 0;
+    std::atomic<uint32_t> heap_count_ = 0;
+
+    bool PushToRing(InlineTask& task, TaskPriority priority) {
+        return priority == kTaskPriorityHigh ? high_.Push(task) : normal_.Push(task);
+    }
+
+    bool PopFromRing(InlineTask& task, TaskPriority priority) {
+        return priority == kTaskPriorityHigh ? high_.Pop(task) : normal_.Pop(task);
+    }
+};
+
+#endif // TASK_QUEUE_H
@@ -0,0 +1,96 @@
+#include "audio_ring.h"
+
+#include <thread>
+#include <vector>
+
+#include "host_test.h"
+
+static void TestFifoAndCapacity() {
+    AudioRing<int> ring(3);
+    CHECK(ring.empty());
+    for (int i = 0; i < 3; i++) {
+        CHECK(ring.Push(std::make_unique<int>(i)));
+    }
+    auto extra = std::make_unique<int>(3);
+    CHECK(!ring.Push(std::move(extra)));
+    // A failed push leaves the item with the caller
+    CHECK(extra != nullptr);
+    CHECK(ring.size() == 3);
+    for (int i = 0; i < 3; i++) {
+        auto item = ring.Pop();
+        CHECK(item != nullptr && *item == i);
+    }
+    CHECK(ring.Pop() == nullptr);
+}
+
+static void TestWrapsAround() {
+    AudioRing<int> ring(2);
+    for (int i = 0; i < 100; i++) {
+        CHECK(ring.Push(std::make_unique<int>(i)));
+        auto item = ring.Pop();
+        CHECK(item != nullptr && *item == i);
+    }
+    CHECK(ring.empty());
+}
+
+// Producers push their numbers in order while a consumer and a clearing task race for them.
+// Nothing may be lost or taken twice, and each producer's numbers must come out in order
+static void TestConcurrentProducersAndConsumers() {
+    const int producers = 4;
+    const int per_producer = 20000;
+    AudioRing<int> ring(8);
+    std::atomic<int> taken = 0;
+    std::vector<std::atomic<int>> counts(producers * per_producer);
+    std::atomic<bool> done = false;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&ring, p]() {
+            for (int i = 0; i < per_producer; i++) {
+                auto item = std::make_unique<int>(p * per_producer + i);
+                while (!ring.Push(std::move(item))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    auto consume = [&]() {
+        std::vector<int> last(producers, -1);
+        bool ordered = true;
+        while (!done || !ring.empty()) {
+            auto item = ring.Pop();
+            if (!item) {
+                std::this_thread::yield();
+                continue;
+            }
+            counts[*item]++;
+            taken++;
+            int producer = *item / per_producer;
+            ordered = ordered && *item > last[producer];
+            last[producer] = *item;
+        }
+        CHECK(ordered);
+    };
+    std::thread consumer(consume);
+    std::thread clearer(consume);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    consumer.join();
+    clearer.join();
+
+    CHECK(taken == producers * per_producer);
+    bool exactly_once = true;
+    for (auto& count : counts) {
+        exactly_once = exactly_once && count == 1;
+    }
+    CHECK(exactly_once);
+}
+
+int main() {
+    TestFifoAndCapacity();
+    TestWrapsAround();
+    TestConcurrentProducersAndConsumers();
+    return HostTestResult();
+}
@@ -0,0 +1,31 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+
+/*
+ * Just enough of a test harness for the host tests: CHECK() reports a failed condition
+ * and keeps going, HostTestResult() is the exit code of the test binary.
+ */
+inline int& HostTestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            HostTestFailures()++; \
+        } \
+    } while (0)
+
+inline int HostTestResult() {
+    if (HostTestFailures() > 0) {
+        fprintf(stderr, "%d check(s) failed\n", HostTestFailures());
+        return 1;
+    }
+    return 0;
+}
+
+#endif // HOST_TEST_H
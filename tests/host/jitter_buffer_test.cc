@@ -0,0 +1,99 @@
+#include "jitter_buffer.h"
+
+#include <esp_timer.h>
+
+#include "host_test.h"
+
+#define FRAME_MS 60
+
+static std::unique_ptr<AudioStreamPacket> MakePacket(uint32_t sequence) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = 24000;
+    packet->frame_duration = FRAME_MS;
+    packet->sequence = sequence;
+    packet->payload.assign(10, uint8_t(sequence));
+    return packet;
+}
+
+static void Advance(int ms) {
+    HostTimerNow() += ms * 1000;
+}
+
+// Plays until the buffer is empty, returning the sequences of the real packets in order
+static std::vector<uint32_t> Drain(JitterBuffer& buffer) {
+    std::vector<uint32_t> played;
+    for (int i = 0; i < 200 && !buffer.empty(); i++) {
+        Advance(FRAME_MS);
+        auto packet = buffer.Get();
+        if (packet && !packet->payload.empty()) {
+            played.push_back(packet->sequence);
+        }
+    }
+    return played;
+}
+
+static void TestPlaysAcrossSequenceWrap() {
+    JitterBuffer buffer(40);
+    uint32_t first = 0xFFFFFFF8;
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < 16; i++) {
+        buffer.Put(MakePacket(first + i));
+        expected.push_back(first + i);
+        Advance(FRAME_MS);
+    }
+    CHECK(Drain(buffer) == expected);
+    CHECK(buffer.statistics().late_count == 0);
+
+    // And keeps going after the wrap
+    for (uint32_t i = 16; i < 24; i++) {
+        buffer.Put(MakePacket(first + i));
+    }
+    CHECK(Drain(buffer).size() == 8);
+    CHECK(buffer.statistics().late_count == 0);
+}
+
+static void TestReorderAcrossWrap() {
+    JitterBuffer buffer(40);
+    buffer.Put(MakePacket(0));
+    buffer.Put(MakePacket(0xFFFFFFFF));
+    buffer.Put(MakePacket(1));
+    std::vector<uint32_t> expected = {0xFFFFFFFF, 0, 1};
+    CHECK(Drain(buffer) == expected);
+    CHECK(buffer.statistics().late_count == 0);
+}
+
+static void TestResyncsWhenServerRestartsSequence() {
+    JitterBuffer buffer(40);
+    for (uint32_t sequence = 5000; sequence < 5010; sequence++) {
+        buffer.Put(MakePacket(sequence));
+    }
+    CHECK(Drain(buffer).size() == 10);
+
+    // The server starts over at 1, which must not be taken for late packets
+    for (uint32_t sequence = 1; sequence <= 10; sequence++) {
+        buffer.Put(MakePacket(sequence));
+    }
+    auto played = Drain(buffer);
+    CHECK(played.size() == 10);
+    CHECK(!played.empty() && played.front() == 1);
+    CHECK(buffer.statistics().late_count == 0);
+}
+
+static void TestLatePacketIsDropped() {
+    JitterBuffer buffer(40);
+    for (uint32_t sequence = 10; sequence < 14; sequence++) {
+        buffer.Put(MakePacket(sequence));
+    }
+    CHECK(Drain(buffer).size() == 4);
+    buffer.Put(MakePacket(12));
+    CHECK(buffer.statistics().late_count == 1);
+    CHECK(buffer.empty());
+}
+
+int main() {
+    TestPlaysAcrossSequenceWrap();
+    TestReorderAcrossWrap();
+    TestResyncsWhenServerRestartsSequence();
+    TestLatePacketIsDropped();
+    return HostTestResult();
+}
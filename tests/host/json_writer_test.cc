@@ -0,0 +1,65 @@
+#include "json_writer.h"
+
+#include <string>
+
+#include "host_test.h"
+
+static std::string Escaped(std::string_view value) {
+    std::string output;
+    JsonWriter::Escape(value, output);
+    return output;
+}
+
+static void TestEscapesQuotesAndBackslashes() {
+    CHECK(Escaped("plain text") == "plain text");
+    CHECK(Escaped("say \"hi\"") == "say \\\"hi\\\"");
+    CHECK(Escaped("C:\\path\\") == "C:\\\\path\\\\");
+    CHECK(Escaped("") == "");
+}
+
+static void TestEscapesControlCharacters() {
+    CHECK(Escaped("a\nb\tc\rd") == "a\\nb\\tc\\rd");
+    CHECK(Escaped("\b\f") == "\\b\\f");
+    CHECK(Escaped(std::string_view("\0", 1)) == "\\u0000");
+    CHECK(Escaped("\x01\x1f") == "\\u0001\\u001f");
+    // DEL is not a control character for JSON
+    CHECK(Escaped("\x7f") == "\x7f");
+}
+
+static void TestPassesUtf8Through() {
+    CHECK(Escaped("你好，小智") == "你好，小智");
+    CHECK(Escaped("😀 \"ok\"") == "😀 \\\"ok\\\"");
+    CHECK(Escaped("café\n") == "café\\n");
+}
+
+static void TestAppendsToOutput() {
+    std::string output = "prefix:";
+    JsonWriter::Escape("\"", output);
+    CHECK(output == "prefix:\\\"");
+}
+
+static void TestWritesNestedObject() {
+    std::string buffer = "stale contents";
+    JsonWriter json(buffer);
+    json.BeginObject()
+        .AddString("type", "listen")
+        .AddString("text", "line1\nline2")
+        .AddNumber("id", -3)
+        .AddBool("ok", true)
+        .BeginArray("items")
+            .AddNumber(nullptr, 1)
+            .BeginObject().AddRaw("raw", "{\"a\":[]}").EndObject()
+        .EndArray()
+        .EndObject();
+    CHECK(buffer == "{\"type\":\"listen\",\"text\":\"line1\\nline2\",\"id\":-3,\"ok\":true,"
+        "\"items\":[1,{\"raw\":{\"a\":[]}}]}");
+}
+
+int main() {
+    TestEscapesQuotesAndBackslashes();
+    TestEscapesControlCharacters();
+    TestPassesUtf8Through();
+    TestAppendsToOutput();
+    TestWritesNestedObject();
+    return HostTestResult();
+}
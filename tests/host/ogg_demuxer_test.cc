@@ -0,0 +1,140 @@
+#include "ogg_demuxer.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "host_test.h"
+
+static uint32_t OggCrc(const uint8_t* data, size_t size) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= uint32_t(data[i]) << 24;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void PutLe32(std::string& page, size_t offset, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        page[offset + i] = char(value >> (8 * i));
+    }
+}
+
+/*
+ * Muxes packets into Ogg pages of at most max_segments lacing values each, so that
+ * packets longer than that continue on the next page. Returns the pages separately.
+ */
+static std::vector<std::string> MuxPages(const std::vector<std::string>& packets, size_t max_segments) {
+    std::vector<std::string> pages;
+    std::vector<uint8_t> lacing;
+    std::string body;
+    bool continued = false;
+    auto flush = [&](bool next_continued) {
+        std::string page(OGG_PAGE_HEADER_SIZE, '\0');
+        memcpy(&page[0], "OggS", 4);
+        page[5] = continued ? OGG_HEADER_TYPE_CONTINUED : 0;
+        PutLe32(page, 6, uint32_t(pages.size() * 960));
+        PutLe32(page, 14, 0x1234);
+        PutLe32(page, 18, uint32_t(pages.size()));
+        page[26] = char(lacing.size());
+        page.append(lacing.begin(), lacing.end());
+        page += body;
+        PutLe32(page, 22, OggCrc(reinterpret_cast<const uint8_t*>(page.data()), page.size()));
+        pages.push_back(page);
+        lacing.clear();
+        body.clear();
+        continued = next_continued;
+    };
+    for (auto& packet : packets) {
+        size_t offset = 0;
+        while (true) {
+            size_t size = std::min<size_t>(packet.size() - offset, 255);
+            lacing.push_back(uint8_t(size));
+            body.append(packet, offset, size);
+            offset += size;
+            bool last = size < 255;
+            if (lacing.size() == max_segments) {
+                flush(!last);
+            }
+            if (last) {
+                break;
+            }
+        }
+    }
+    if (!lacing.empty()) {
+        flush(false);
+    }
+    return pages;
+}
+
+static std::string OpusHead() {
+    std::string head("OpusHead", 8);
+    head += char(1);                        // version
+    head += char(1);                        // channels
+    head += std::string("\x38\x01", 2);     // pre-skip 312
+    head += std::string("\x80\x3e\0\0", 4); // 16000 Hz
+    head += std::string(3, '\0');           // gain, mapping family
+    return head;
+}
+
+static std::string Packet(size_t size, char fill) {
+    return std::string(size, fill);
+}
+
+static std::vector<std::string> ReadAll(const std::string& stream) {
+    OggOpusReader reader;
+    reader.Open(stream);
+    std::vector<std::string> packets;
+    std::string_view packet;
+    while (reader.NextPacket(packet)) {
+        packets.emplace_back(packet);
+    }
+    return packets;
+}
+
+static std::string Join(const std::vector<std::string>& pages) {
+    std::string stream;
+    for (auto& page : pages) {
+        stream += page;
+    }
+    return stream;
+}
+
+static void TestPacketSpanningPagesIsAssembled() {
+    std::vector<std::string> audio = {Packet(100, 'a'), Packet(700, 'b'), Packet(20, 'c')};
+    std::vector<std::string> packets = {OpusHead(), "OpusTags" + std::string(8, '\0')};
+    packets.insert(packets.end(), audio.begin(), audio.end());
+    // Two lacing values per page, the 700 byte packet takes three pages
+    auto pages = MuxPages(packets, 2);
+    CHECK(pages.size() > 3);
+    CHECK(ReadAll(Join(pages)) == audio);
+}
+
+static void TestLongOpusTagsAreSkipped() {
+    std::vector<std::string> audio = {Packet(40, 'x'), Packet(255, 'y'), Packet(510, 'z')};
+    std::vector<std::string> packets = {OpusHead(), "OpusTags" + Packet(2000, 't')};
+    packets.insert(packets.end(), audio.begin(), audio.end());
+    CHECK(ReadAll(Join(MuxPages(packets, 3))) == audio);
+}
+
+static void TestLostContinuationDropsOnlyThatPacket() {
+    std::vector<std::string> packets = {OpusHead(), "OpusTags" + std::string(8, '\0'),
+        Packet(30, 'a'), Packet(600, 'b'), Packet(30, 'c'), Packet(30, 'd')};
+    auto pages = MuxPages(packets, 2);
+    // Page 1 holds 'a' and the head of 'b', page 2 the rest of it: corrupt page 2
+    CHECK(pages.size() == 4);
+    pages[2][OGG_PAGE_HEADER_SIZE + pages[2][26]] ^= 0xFF;
+    auto read = ReadAll(Join(pages));
+    std::vector<std::string> expected = {Packet(30, 'a'), Packet(30, 'c'), Packet(30, 'd')};
+    CHECK(read == expected);
+}
+
+int main() {
+    TestPacketSpanningPagesIsAssembled();
+    TestLongOpusTagsAreSkipped();
+    TestLostContinuationDropsOnlyThatPacket();
+    return HostTestResult();
+}
@@ -0,0 +1,7 @@
+#ifndef HOST_STUB_CJSON_H
+#define HOST_STUB_CJSON_H
+
+// Only declared by the headers the host tests include
+typedef struct cJSON cJSON;
+
+#endif // HOST_STUB_CJSON_H
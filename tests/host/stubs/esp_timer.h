@@ -0,0 +1,16 @@
+#ifndef HOST_STUB_ESP_TIMER_H
+#define HOST_STUB_ESP_TIMER_H
+
+#include <cstdint>
+
+// The host tests drive the clock themselves
+inline int64_t& HostTimerNow() {
+    static int64_t now_us = 1000000;
+    return now_us;
+}
+
+inline int64_t esp_timer_get_time() {
+    return HostTimerNow();
+}
+
+#endif // HOST_STUB_ESP_TIMER_H
@@ -0,0 +1,172 @@
+#include "task_queue.h"
+
+#include <array>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "host_test.h"
+
+#define PRODUCERS 4
+#define TASKS_PER_PRODUCER 20000
+
+// Counts live copies, so a leaked or doubly destroyed capture shows up
+struct Tracked {
+    static int& live() {
+        static int count = 0;
+        return count;
+    }
+    Tracked() { live()++; }
+    Tracked(const Tracked&) { live()++; }
+    Tracked(Tracked&&) noexcept { live()++; }
+    ~Tracked() { live()--; }
+};
+
+static void TestSmallCapturesStayInline() {
+    int calls = 0;
+    // A pointer and a few ints, like [this, id]; a std::string is 24 bytes on the target but 32 here
+    int amount = 5;
+    int64_t unused[2] = {};
+    InlineTask task([&calls, amount, unused]() {
+        calls += amount + int(unused[0]);
+    });
+    CHECK(task);
+    CHECK(!task.on_heap());
+    task();
+    CHECK(calls == 5);
+}
+
+static void TestLargeCapturesMoveToHeap() {
+    std::array<char, INLINE_TASK_SIZE * 2> big = {};
+    big[0] = 7;
+    int result = 0;
+    InlineTask task([&result, big]() {
+        result = big[0];
+    });
+    CHECK(task.on_heap());
+    task();
+    CHECK(result == 7);
+}
+
+static void TestMoveAndDestroy() {
+    {
+        Tracked tracked;
+        InlineTask inline_task([tracked]() {});
+        InlineTask heap_task([tracked, padding = std::array<char, INLINE_TASK_SIZE>()]() {});
+        CHECK(Tracked::live() == 3);
+
+        InlineTask moved(std::move(inline_task));
+        CHECK(!inline_task);
+        CHECK(moved);
+        InlineTask assigned;
+        assigned = std::move(heap_task);
+        CHECK(!heap_task);
+        CHECK(assigned.on_heap());
+        CHECK(Tracked::live() == 3);
+
+        moved.Reset();
+        CHECK(!moved);
+        CHECK(Tracked::live() == 2);
+    }
+    CHECK(Tracked::live() == 0);
+}
+
+static void TestHighPriorityRunsFirst() {
+    TaskQueue queue;
+    std::vector<int> order;
+    queue.Push([&order]() { order.push_back(1); }, kTaskPriorityNormal);
+    queue.Push([&order]() { order.push_back(2); }, kTaskPriorityHigh);
+    queue.Push([&order]() { order.push_back(3); }, kTaskPriorityNormal);
+    InlineTask task;
+    while (queue.Pop(task)) {
+        task();
+    }
+    CHECK((order == std::vector<int>{2, 1, 3}));
+}
+
+static void TestOverflowKeepsOrder() {
+    TaskQueue queue;
+    std::vector<int> order;
+    const int count = TASK_QUEUE_NORMAL_CAPACITY * 3;
+    for (int i = 0; i < count; i++) {
+        queue.Push([&order, i]() { order.push_back(i); }, kTaskPriorityNormal);
+    }
+    CHECK(queue.overflow_count() == count - TASK_QUEUE_NORMAL_CAPACITY);
+    InlineTask task;
+    while (queue.Pop(task)) {
+        task();
+    }
+    CHECK(int(order.size()) == count);
+    for (int i = 0; i < int(order.size()); i++) {
+        CHECK(order[i] == i);
+    }
+}
+
+// Every task runs exactly once, and the tasks of each producer in the order they were pushed
+static void TestConcurrentProducers() {
+    TaskQueue queue;
+    // Only touched by the consumer thread, from inside the tasks
+    std::array<int, PRODUCERS> next = {};
+    int out_of_order = 0;
+    int executed = 0;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < TASKS_PER_PRODUCER; i++) {
+                // Every other producer mixes in high priority tasks, ordered within their own lane
+                auto priority = (p % 2 == 1 && i % 3 == 0) ? kTaskPriorityHigh : kTaskPriorityNormal;
+                queue.Push([&next, &out_of_order, &executed, p, i, priority]() {
+                    int lane_index = p * 2 + (priority == kTaskPriorityHigh ? 1 : 0);
+                    static thread_local std::array<int, PRODUCERS * 2> last;
+                    static thread_local bool initialized = false;
+                    if (!initialized) {
+                        last.fill(-1);
+                        initialized = true;
+                    }
+                    if (i <= last[lane_index]) {
+                        out_of_order++;
+                    }
+                    last[lane_index] = i;
+                    next[p]++;
+                    executed++;
+                }, priority);
+            }
+        });
+    }
+
+    const int total = PRODUCERS * TASKS_PER_PRODUCER;
+    std::thread consumer([&]() {
+        InlineTask task;
+        while (executed < total) {
+            if (queue.Pop(task)) {
+                task();
+                task.Reset();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    consumer.join();
+
+    CHECK(executed == total);
+    CHECK(out_of_order == 0);
+    for (int p = 0; p < PRODUCERS; p++) {
+        CHECK(next[p] == TASKS_PER_PRODUCER);
+    }
+    InlineTask task;
+    CHECK(!queue.Pop(task));
+}
+
+int main() {
+    TestSmallCapturesStayInline();
+    TestLargeCapturesMoveToHeap();
+    TestMoveAndDestroy();
+    TestHighPriorityRunsFirst();
+    TestOverflowKeepsOrder();
+    TestConcurrentProducers();
+    return HostTestResult();
+}
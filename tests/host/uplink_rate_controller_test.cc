@@ -0,0 +1,88 @@
+#include "uplink_rate_controller.h"
+
+#include "host_test.h"
+
+static void TestLossDecaysToZero() {
+    UplinkRateController controller(8000, 24000);
+    controller.OnLinkReport(100, 8);
+    controller.OnUplinkLoss(8);
+    CHECK(controller.downlink_loss_percent() == 8);
+    CHECK(controller.uplink_loss_percent() == 8);
+    for (int i = 0; i < 200; i++) {
+        controller.OnLinkReport(100, 0);
+        controller.OnUplinkLoss(0);
+    }
+    CHECK(controller.downlink_loss_percent() == 0);
+    CHECK(controller.uplink_loss_percent() == 0);
+    controller.OnFrameQueued(0, 40, 0);
+    auto target = controller.target();
+    CHECK(!target.fec);
+    CHECK(target.loss_percent == 0);
+}
+
+static void TestFecFollowsUplinkLoss() {
+    UplinkRateController controller(8000, 24000);
+    controller.OnLinkReport(100, 0);
+    controller.OnUplinkLoss(5);
+    CHECK(controller.OnFrameQueued(0, 40, 0));
+    CHECK(controller.target().fec);
+    CHECK(controller.target().loss_percent == 5);
+    // A single clean report does not switch FEC off again
+    controller.OnUplinkLoss(0);
+    controller.OnFrameQueued(0, 40, 60);
+    CHECK(controller.target().fec);
+}
+
+static void TestDownlinkLossNeverEnablesFec() {
+    UplinkRateController controller(8000, 24000);
+    controller.OnLinkReport(100, 20);
+    controller.OnFrameQueued(0, 40, 1000);
+    CHECK(!controller.target().fec);
+    // but it does count as congestion
+    CHECK(controller.target().bitrate == 18000);
+}
+
+static void TestBitrateRecoversAfterCongestion() {
+    UplinkRateController controller(8000, 24000);
+    controller.OnLinkReport(100, 8);
+    controller.OnUplinkLoss(8);
+    int64_t now = 1000;
+    // A backed up send queue cuts the bitrate
+    CHECK(controller.OnFrameQueued(20, 40, now));
+    CHECK(controller.target().bitrate == 18000);
+
+    // Two minutes of a clean link in 60 ms frames and one report per 50 frames
+    for (int frame = 0; frame < 2000; frame++) {
+        now += 60;
+        if (frame % 50 == 0) {
+            controller.OnLinkReport(100, 0);
+            controller.OnUplinkLoss(0);
+        }
+        controller.OnFrameQueued(0, 40, now);
+    }
+    CHECK(controller.uplink_loss_percent() == 0);
+    CHECK(!controller.target().fec);
+    CHECK(controller.target().bitrate == 24000);
+}
+
+static void TestBoundsClampTarget() {
+    UplinkRateController controller(8000, 24000);
+    controller.SetBounds(10000, 16000);
+    CHECK(controller.target().bitrate == 16000);
+    // Ignored, the range is inverted
+    controller.SetBounds(20000, 12000);
+    CHECK(controller.target().bitrate == 16000);
+    for (int i = 0; i < 10; i++) {
+        controller.OnFrameQueued(40, 40, i * UPLINK_DECREASE_HOLD_MS);
+    }
+    CHECK(controller.target().bitrate == 10000);
+}
+
+int main() {
+    TestLossDecaysToZero();
+    TestFecFollowsUplinkLoss();
+    TestDownlinkLossNeverEnablesFec();
+    TestBitrateRecoversAfterCongestion();
+    TestBoundsClampTarget();
+    return HostTestResult();
+}